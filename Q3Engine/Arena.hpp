@@ -0,0 +1,142 @@
+#pragma once
+
+#include "Buffer.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace q3 {
+
+/**
+ * @brief A linear allocator for memory that lives until the next reset().
+ *
+ * allocate() bumps a cursor through a list of BufferMemory blocks and moves
+ * on to the next block that fits when the current one is full, adding a
+ * block of twice the size of the last one if none does. Allocations never
+ * move and are never freed one by one. reset() rewinds to the first block in
+ * O(1) and keeps every block, so once an arena has seen its largest frame it
+ * allocates nothing anymore. getHighWaterMark() reports the most bytes used
+ * between two resets, including alignment padding and the skipped tails of
+ * full blocks.
+ *
+ * Objects placed in an arena are never destroyed, so they must be trivially
+ * destructible. An arena is not thread-safe, the rasterizer keeps one per
+ * thread.
+ */
+class LinearArena {
+public:
+    static constexpr std::size_t DEFAULT_BLOCK_SIZE = static_cast<std::size_t>(64) << 10;
+
+    explicit LinearArena(std::size_t block_size = DEFAULT_BLOCK_SIZE)
+        : block_size_(std::max<std::size_t>(block_size, BufferMemory::ALIGNMENT)), next_block_(0), cursor_(nullptr), end_(nullptr),
+          used_bytes_(0), high_water_mark_(0) {}
+    LinearArena(const LinearArena&) = delete;
+    LinearArena& operator=(const LinearArena&) = delete;
+    LinearArena(LinearArena&& other) noexcept
+        : block_size_(other.block_size_), blocks_(std::move(other.blocks_)), next_block_(std::exchange(other.next_block_, 0)),
+          cursor_(std::exchange(other.cursor_, nullptr)), end_(std::exchange(other.end_, nullptr)),
+          used_bytes_(std::exchange(other.used_bytes_, 0)), high_water_mark_(other.high_water_mark_) {
+        other.blocks_.clear();
+    }
+    LinearArena& operator=(LinearArena&& other) noexcept {
+        if (this != &other) {
+            freeBlocks();
+            block_size_ = other.block_size_;
+            blocks_ = std::move(other.blocks_);
+            other.blocks_.clear();
+            next_block_ = std::exchange(other.next_block_, 0);
+            cursor_ = std::exchange(other.cursor_, nullptr);
+            end_ = std::exchange(other.end_, nullptr);
+            used_bytes_ = std::exchange(other.used_bytes_, 0);
+            high_water_mark_ = other.high_water_mark_;
+        }
+        return *this;
+    }
+    ~LinearArena() { freeBlocks(); }
+
+    // uninitialized memory of bytes bytes, alignment is a power of two of at most BufferMemory::ALIGNMENT
+    inline void* allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t)) {
+        if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment > BufferMemory::ALIGNMENT) {
+            throw std::invalid_argument("alignment must be a power of two of at most BufferMemory::ALIGNMENT");
+        }
+        uint8_t* memory = alignUp(cursor_, alignment);
+        if (cursor_ == nullptr || bytes > static_cast<std::size_t>(end_ - memory)) { memory = nextBlock(bytes); }
+        used_bytes_ += static_cast<std::size_t>(memory - cursor_) + bytes;
+        high_water_mark_ = std::max(high_water_mark_, used_bytes_);
+        cursor_ = memory + bytes;
+        return memory;
+    }
+
+    // uninitialized storage for count objects of type T
+    template<typename T>
+    inline T* allocateArray(std::size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    // invalidates every allocation, keeps the blocks for the next allocations
+    inline void reset() {
+        next_block_ = 0;
+        cursor_ = nullptr;
+        end_ = nullptr;
+        used_bytes_ = 0;
+    }
+
+    std::size_t getUsedBytes() const { return used_bytes_; }
+    std::size_t getHighWaterMark() const { return high_water_mark_; }
+    std::size_t getCapacity() const {
+        std::size_t capacity = 0;
+        for (const Block& block : blocks_) { capacity += block.bytes; }
+        return capacity;
+    }
+
+private:
+    struct Block {
+        uint8_t* memory;
+        std::size_t bytes;
+    };
+
+    static inline uint8_t* alignUp(uint8_t* pointer, std::size_t alignment) {
+        const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(pointer);
+        return pointer + ((alignment - address % alignment) % alignment);
+    }
+
+    // moves to the first following block of at least bytes bytes, blocks start on BufferMemory::ALIGNMENT boundaries
+    inline uint8_t* nextBlock(std::size_t bytes) {
+        // the tail of the current block stays unused until the next reset
+        used_bytes_ += static_cast<std::size_t>(end_ - cursor_);
+        while (next_block_ < blocks_.size() && blocks_[next_block_].bytes < bytes) {
+            used_bytes_ += blocks_[next_block_].bytes;
+            next_block_++;
+        }
+        if (next_block_ == blocks_.size()) {
+            std::size_t block_bytes = std::max(bytes, blocks_.empty() ? block_size_ : blocks_.back().bytes * 2);
+            uint8_t* memory = static_cast<uint8_t*>(BufferMemory::allocate(block_bytes, false));
+            blocks_.push_back(Block{memory, block_bytes});
+        }
+        const Block& block = blocks_[next_block_++];
+        cursor_ = block.memory;
+        end_ = block.memory + block.bytes;
+        return block.memory;
+    }
+
+    inline void freeBlocks() {
+        for (const Block& block : blocks_) { BufferMemory::free(block.memory); }
+        blocks_.clear();
+    }
+
+    std::size_t block_size_;
+    std::vector<Block> blocks_;
+    std::size_t next_block_; // index of the block after the current one
+    uint8_t* cursor_;
+    uint8_t* end_;
+    std::size_t used_bytes_;
+    std::size_t high_water_mark_;
+};
+
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "RGBColor.hpp"
+#include "Simd.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace q3 {
+
+/**
+ * @brief How a fragment of color src and alpha a is combined with the framebuffer color dst.
+ *
+ * All modes work on 8 bit integers, a product x * y / 255 is rounded to
+ * nearest with ((x * y + 128) * 257) >> 16. The alpha of the result is
+ * a + dst.a * (1 - a) in every mode, color channels saturate at 255.
+ */
+enum class BLEND_MODE {
+    ALPHA,         // src * a + dst * (1 - a), the default
+    PREMULTIPLIED, // src + dst * (1 - a), src is already multiplied by a
+    ADDITIVE,      // dst + src * a
+    MULTIPLY       // dst * (src * a + (1 - a)), src tints dst by a
+};
+
+// true if fragments with alpha 255 replace the framebuffer color, so the framebuffer is not read for them
+inline bool blendReplacesOpaque(BLEND_MODE mode) { return mode == BLEND_MODE::ALPHA || mode == BLEND_MODE::PREMULTIPLIED; }
+
+// x / 255 rounded to nearest, x must not exceed 65535 - 128
+inline uint32_t divide255(uint32_t x) { return ((x + 128) * 257) >> 16; }
+
+inline RGBColor blendPixel(BLEND_MODE mode, const RGBColor& src, const RGBColor& dst) {
+    const uint32_t a = src.a;
+    const uint32_t inv = 255 - a;
+    const uint8_t alpha = static_cast<uint8_t>(a + divide255(dst.a * inv));
+    switch (mode) {
+    case BLEND_MODE::PREMULTIPLIED:
+        return RGBColor{static_cast<uint8_t>(std::min(255u, src.r + divide255(dst.r * inv))),
+                        static_cast<uint8_t>(std::min(255u, src.g + divide255(dst.g * inv))),
+                        static_cast<uint8_t>(std::min(255u, src.b + divide255(dst.b * inv))), alpha};
+    case BLEND_MODE::ADDITIVE:
+        return RGBColor{static_cast<uint8_t>(std::min(255u, dst.r + divide255(src.r * a))),
+                        static_cast<uint8_t>(std::min(255u, dst.g + divide255(src.g * a))),
+                        static_cast<uint8_t>(std::min(255u, dst.b + divide255(src.b * a))), alpha};
+    case BLEND_MODE::MULTIPLY:
+        return RGBColor{static_cast<uint8_t>(divide255(dst.r * (divide255(src.r * a) + inv))),
+                        static_cast<uint8_t>(divide255(dst.g * (divide255(src.g * a) + inv))),
+                        static_cast<uint8_t>(divide255(dst.b * (divide255(src.b * a) + inv))), alpha};
+    case BLEND_MODE::ALPHA:
+    default:
+        return RGBColor{static_cast<uint8_t>(divide255(src.r * a + dst.r * inv)),
+                        static_cast<uint8_t>(divide255(src.g * a + dst.g * inv)),
+                        static_cast<uint8_t>(divide255(src.b * a + dst.b * inv)), alpha};
+    }
+}
+
+#ifdef Q3_SSE2
+inline __m128i divide255Sse2(__m128i x) { return _mm_mulhi_epu16(_mm_add_epi16(x, _mm_set1_epi16(128)), _mm_set1_epi16(257)); }
+
+// blends two pixels unpacked to 16 bit channels, r g b a r g b a, same results as blendPixel()
+inline __m128i blendWordsSse2(BLEND_MODE mode, __m128i src, __m128i dst) {
+    const __m128i alpha_lanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    const __m128i c255 = _mm_set1_epi16(255);
+    const __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(src, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    const __m128i inv = _mm_sub_epi16(c255, a);
+    // a for the color channels and 255 for alpha, src * src_factor / 255 gives src * a and src.a
+    const __m128i src_factor = _mm_or_si128(_mm_andnot_si128(alpha_lanes, a), _mm_and_si128(alpha_lanes, c255));
+    switch (mode) {
+    case BLEND_MODE::PREMULTIPLIED:
+        return _mm_add_epi16(src, divide255Sse2(_mm_mullo_epi16(dst, inv)));
+    case BLEND_MODE::ADDITIVE: {
+        const __m128i dst_term = _mm_or_si128(_mm_andnot_si128(alpha_lanes, dst), _mm_and_si128(alpha_lanes, divide255Sse2(_mm_mullo_epi16(dst, inv))));
+        return _mm_add_epi16(divide255Sse2(_mm_mullo_epi16(src, src_factor)), dst_term);
+    }
+    case BLEND_MODE::MULTIPLY: {
+        const __m128i tint = _mm_add_epi16(divide255Sse2(_mm_mullo_epi16(src, a)), inv);
+        const __m128i dst_factor = _mm_or_si128(_mm_andnot_si128(alpha_lanes, tint), _mm_and_si128(alpha_lanes, inv));
+        return _mm_add_epi16(divide255Sse2(_mm_mullo_epi16(dst, dst_factor)), _mm_and_si128(alpha_lanes, a));
+    }
+    case BLEND_MODE::ALPHA:
+    default:
+        // the products sum to at most 255 * 255 and fit into 16 bits
+        return divide255Sse2(_mm_add_epi16(_mm_mullo_epi16(src, src_factor), _mm_mullo_epi16(dst, inv)));
+    }
+}
+#endif
+
+#ifdef Q3_AVX2
+Q3_TARGET_AVX2 inline __m256i divide255Avx2(__m256i x) {
+    return _mm256_mulhi_epu16(_mm256_add_epi16(x, _mm256_set1_epi16(128)), _mm256_set1_epi16(257));
+}
+
+Q3_TARGET_AVX2 inline __m256i blendWordsAvx2(BLEND_MODE mode, __m256i src, __m256i dst) {
+    const __m256i alpha_lanes = _mm256_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0);
+    const __m256i c255 = _mm256_set1_epi16(255);
+    const __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(src, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    const __m256i inv = _mm256_sub_epi16(c255, a);
+    const __m256i src_factor = _mm256_blendv_epi8(a, c255, alpha_lanes);
+    switch (mode) {
+    case BLEND_MODE::PREMULTIPLIED:
+        return _mm256_add_epi16(src, divide255Avx2(_mm256_mullo_epi16(dst, inv)));
+    case BLEND_MODE::ADDITIVE: {
+        const __m256i dst_term = _mm256_blendv_epi8(dst, divide255Avx2(_mm256_mullo_epi16(dst, inv)), alpha_lanes);
+        return _mm256_add_epi16(divide255Avx2(_mm256_mullo_epi16(src, src_factor)), dst_term);
+    }
+    case BLEND_MODE::MULTIPLY: {
+        const __m256i tint = _mm256_add_epi16(divide255Avx2(_mm256_mullo_epi16(src, a)), inv);
+        const __m256i dst_factor = _mm256_blendv_epi8(tint, inv, alpha_lanes);
+        return _mm256_add_epi16(divide255Avx2(_mm256_mullo_epi16(dst, dst_factor)), _mm256_and_si256(alpha_lanes, a));
+    }
+    case BLEND_MODE::ALPHA:
+    default:
+        return divide255Avx2(_mm256_add_epi16(_mm256_mullo_epi16(src, src_factor), _mm256_mullo_epi16(dst, inv)));
+    }
+}
+
+// blends the leading multiple of eight pixels and returns their number
+Q3_TARGET_AVX2 inline uint32_t blendPixelsAvx2(BLEND_MODE mode, const RGBColor* src, RGBColor* dst, uint32_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        const __m256i lo = blendWordsAvx2(mode, _mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero));
+        const __m256i hi = blendWordsAvx2(mode, _mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_packus_epi16(lo, hi));
+    }
+    return i;
+}
+#endif
+
+/**
+ * @brief Blends count pixels of src over dst in place, same results as blendPixel() per pixel.
+ *
+ * The SIMD versions blend four (SSE2) or eight (AVX2) packed pixels per step,
+ * the color channels saturate when they are packed back to bytes.
+ */
+inline void blendPixels(BLEND_MODE mode, const RGBColor* src, RGBColor* dst, uint32_t count, SIMD_LEVEL level) {
+    static_assert(sizeof(RGBColor) == 4, "RGBColor must be 4 packed bytes");
+    uint32_t i = 0;
+#ifdef Q3_AVX2
+    if (level == SIMD_LEVEL::AVX2) { i = blendPixelsAvx2(mode, src, dst, count); }
+#endif
+#ifdef Q3_SSE2
+    if (level != SIMD_LEVEL::SCALAR) {
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 4 <= count; i += 4) {
+            const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+            const __m128i lo = blendWordsSse2(mode, _mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+            const __m128i hi = blendWordsSse2(mode, _mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+        }
+    }
+#endif
+    (void)level;
+    for (; i < count; i++) { dst[i] = blendPixel(mode, src[i], dst[i]); }
+}
+
+}
@@ -1,53 +1,475 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <utility>
 #include <vector>
 #include <stdexcept>
 #include <type_traits>
 #include <tuple>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <numeric>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
 namespace q3 {
 
-template<typename T>
+// spreads the low 16 bits of value to the even bits
+inline uint32_t spreadBits(uint32_t value) {
+    value &= 0xFFFF;
+    value = (value | (value << 8)) & 0x00FF00FF;
+    value = (value | (value << 4)) & 0x0F0F0F0F;
+    value = (value | (value << 2)) & 0x33333333;
+    value = (value | (value << 1)) & 0x55555555;
+    return value;
+}
+
+/**
+ * @brief Memory layouts of GraphicsBuffer, they map pixel (x, y) to an index into the storage.
+ *
+ * A layout is constructed from the size of the buffer and the row alignment in
+ * elements, which only the linear layout uses to pad its row pitch. It provides
+ * - size(): the number of stored elements, at least width * height
+ * - index(x, y): the storage index of pixel (x, y)
+ * - rowToLinear() and rowFromLinear(): copy a whole pixel row between the storage and a row-major row
+ *
+ * LINEAR is only true for the row-major layout, the only one with contiguous rows.
+ */
+class LinearLayout {
+public:
+    static constexpr bool LINEAR = true;
+
+    LinearLayout() : width_(0), height_(0), pitch_(0) {}
+    LinearLayout(uint32_t width, uint32_t height, uint32_t row_alignment = 1)
+        : width_(width), height_(height), pitch_((width + row_alignment - 1) / row_alignment * row_alignment) {}
+
+    std::size_t size() const { return static_cast<std::size_t>(pitch_) * height_; }
+    std::size_t index(uint32_t x, uint32_t y) const { return x + static_cast<std::size_t>(pitch_) * y; }
+    // elements from the start of a row to the start of the next one
+    uint32_t getPitch() const { return pitch_; }
+
+    template<typename T>
+    void rowToLinear(const T* data, uint32_t y, T* row) const { std::copy_n(data + index(0, y), width_, row); }
+    template<typename T>
+    void rowFromLinear(T* data, uint32_t y, const T* row) const { std::copy_n(row, width_, data + index(0, y)); }
+
+private:
+    uint32_t width_;
+    uint32_t height_;
+    uint32_t pitch_;
+};
+
+// TILE_SIZE x TILE_SIZE pixel tiles stored one after another in row-major order, row-major inside a tile,
+// the size is padded to whole tiles
+class TiledLayout {
+public:
+    static constexpr bool LINEAR = false;
+    static constexpr uint32_t TILE_SHIFT = 3;
+    static constexpr uint32_t TILE_SIZE = 1 << TILE_SHIFT;
+
+    TiledLayout() : width_(0), tiles_x_(0), tiles_y_(0) {}
+    TiledLayout(uint32_t width, uint32_t height, uint32_t /*row_alignment*/ = 1)
+        : width_(width), tiles_x_((width + TILE_SIZE - 1) >> TILE_SHIFT), tiles_y_((height + TILE_SIZE - 1) >> TILE_SHIFT) {}
+
+    std::size_t size() const { return static_cast<std::size_t>(tiles_x_) * tiles_y_ * TILE_SIZE * TILE_SIZE; }
+    std::size_t index(uint32_t x, uint32_t y) const {
+        const std::size_t tile = static_cast<std::size_t>(y >> TILE_SHIFT) * tiles_x_ + (x >> TILE_SHIFT);
+        return (tile << (2 * TILE_SHIFT)) | ((y & (TILE_SIZE - 1)) << TILE_SHIFT) | (x & (TILE_SIZE - 1));
+    }
+
+    // the row is stored in runs of TILE_SIZE pixels, one per tile
+    template<typename T>
+    void rowToLinear(const T* data, uint32_t y, T* row) const {
+        const T* tile_row = data + index(0, y);
+        for (uint32_t x = 0; x < width_; x += TILE_SIZE, tile_row += TILE_SIZE * TILE_SIZE) {
+            std::copy_n(tile_row, std::min(TILE_SIZE, width_ - x), row + x);
+        }
+    }
+    template<typename T>
+    void rowFromLinear(T* data, uint32_t y, const T* row) const {
+        T* tile_row = data + index(0, y);
+        for (uint32_t x = 0; x < width_; x += TILE_SIZE, tile_row += TILE_SIZE * TILE_SIZE) {
+            std::copy_n(row + x, std::min(TILE_SIZE, width_ - x), tile_row);
+        }
+    }
+
+private:
+    uint32_t width_;
+    uint32_t tiles_x_;
+    uint32_t tiles_y_;
+};
+
+// Z-order curve: each side is padded to a power of two, the low bits of x and y are interleaved (x in the even bits)
+// and the remaining high bits of the longer side select a square of the curve
+class MortonLayout {
+public:
+    static constexpr bool LINEAR = false;
+
+    MortonLayout() : width_(0), square_bits_(0), size_(0) {}
+    MortonLayout(uint32_t width, uint32_t height, uint32_t /*row_alignment*/ = 1) : width_(width) {
+        const uint32_t width_bits = ceilLog2(width);
+        const uint32_t height_bits = ceilLog2(height);
+        square_bits_ = std::min(width_bits, height_bits);
+        if (square_bits_ > 16) { throw std::invalid_argument("Morton layout supports at most 65536 pixels on the shorter side."); }
+        size_ = (static_cast<std::size_t>(1) << width_bits) << height_bits;
+    }
+
+    std::size_t size() const { return size_; }
+    std::size_t index(uint32_t x, uint32_t y) const {
+        const uint32_t low = (1u << square_bits_) - 1;
+        // at most one of the high parts is not 0
+        const std::size_t square = static_cast<std::size_t>((x >> square_bits_) | (y >> square_bits_)) << (2 * square_bits_);
+        return square | spreadBits(x & low) | (spreadBits(y & low) << 1);
+    }
+
+    // steps through the interleaved x bits instead of spreading every x
+    template<typename T>
+    void rowToLinear(const T* data, uint32_t y, T* row) const {
+        const std::size_t y_index = index(0, y);
+        const uint32_t x_mask = spreadBits((1u << square_bits_) - 1);
+        uint32_t x_bits = 0;
+        for (uint32_t x = 0; x < width_; x++) {
+            row[x] = data[y_index + ((static_cast<std::size_t>(x >> square_bits_) << (2 * square_bits_)) | x_bits)];
+            x_bits = ((x_bits | ~x_mask) + 1) & x_mask;
+        }
+    }
+    template<typename T>
+    void rowFromLinear(T* data, uint32_t y, const T* row) const {
+        const std::size_t y_index = index(0, y);
+        const uint32_t x_mask = spreadBits((1u << square_bits_) - 1);
+        uint32_t x_bits = 0;
+        for (uint32_t x = 0; x < width_; x++) {
+            data[y_index + ((static_cast<std::size_t>(x >> square_bits_) << (2 * square_bits_)) | x_bits)] = row[x];
+            x_bits = ((x_bits | ~x_mask) + 1) & x_mask;
+        }
+    }
+
+private:
+    static uint32_t ceilLog2(uint32_t value) {
+        uint32_t bits = 0;
+        while (bits < 32 && (static_cast<uint64_t>(1) << bits) < value) { bits++; }
+        return bits;
+    }
+
+    uint32_t width_;
+    uint32_t square_bits_;
+    std::size_t size_;
+};
+
+// cache line aligned memory blocks of GraphicsBuffer
+class BufferMemory {
+public:
+    static constexpr std::size_t ALIGNMENT = 64;
+    static constexpr std::size_t HUGE_PAGE_SIZE = static_cast<std::size_t>(2) << 20;
+
+    // bytes is rounded up to the size of the block, huge page blocks are aligned and padded to whole huge pages
+    static inline void* allocate(std::size_t& bytes, bool huge_pages) {
+        const bool huge = huge_pages && bytes >= HUGE_PAGE_SIZE;
+        const std::size_t alignment = huge ? HUGE_PAGE_SIZE : ALIGNMENT;
+        bytes = (bytes + alignment - 1) / alignment * alignment;
+        void* block = nullptr;
+#ifdef _WIN32
+        block = _aligned_malloc(bytes, alignment);
+#else
+        if (posix_memalign(&block, alignment, bytes) != 0) { block = nullptr; }
+#endif
+        if (block == nullptr) { throw std::bad_alloc(); }
+#ifdef __linux__
+        // only advice, the pages are not touched yet so the kernel can back them with huge pages right away
+        if (huge) { madvise(block, bytes, MADV_HUGEPAGE); }
+#endif
+        return block;
+    }
+
+    static inline void free(void* block) {
+#ifdef _WIN32
+        _aligned_free(block);
+#else
+        std::free(block);
+#endif
+    }
+};
+
+/**
+ * @brief A cache of the memory of destroyed GraphicsBuffer instances.
+ *
+ * Buffers allocated from a pool hand their memory back to it when they are
+ * destroyed, and later buffers take the smallest cached block that fits and
+ * is at most twice as large instead of going to the allocator. Switching
+ * between a few sizes frame to frame then allocates nothing. The pool keeps
+ * at most getCapacity() bytes and frees the oldest blocks first. It is
+ * thread-safe, and every buffer keeps its pool alive.
+ */
+class BufferPool {
+public:
+    static constexpr std::size_t DEFAULT_CAPACITY = static_cast<std::size_t>(256) << 20;
+
+    explicit BufferPool(std::size_t capacity = DEFAULT_CAPACITY) : capacity_(capacity), cached_bytes_(0) {}
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+    ~BufferPool() { clear(); }
+
+    inline void setCapacity(std::size_t capacity) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capacity_ = capacity;
+        trim();
+    }
+    std::size_t getCapacity() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return capacity_;
+    }
+    std::size_t getCachedBytes() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return cached_bytes_;
+    }
+
+    // frees every cached block
+    inline void clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const Block& block : blocks_) { BufferMemory::free(block.memory); }
+        blocks_.clear();
+        cached_bytes_ = 0;
+    }
+
+    // a block of at least bytes bytes like BufferMemory::allocate(), bytes is set to the size of the block
+    inline void* acquire(std::size_t& bytes, bool huge_pages) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto best = blocks_.end();
+            for (auto it = blocks_.begin(); it != blocks_.end(); ++it) {
+                if (it->bytes < bytes || it->bytes / 2 > bytes) continue;
+                if (best == blocks_.end() || it->bytes < best->bytes) { best = it; }
+            }
+            if (best != blocks_.end()) {
+                void* memory = best->memory;
+                bytes = best->bytes;
+                cached_bytes_ -= best->bytes;
+                blocks_.erase(best);
+                return memory;
+            }
+        }
+        return BufferMemory::allocate(bytes, huge_pages);
+    }
+
+    inline void release(void* memory, std::size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        blocks_.push_back(Block{memory, bytes});
+        cached_bytes_ += bytes;
+        trim();
+    }
+
+private:
+    struct Block {
+        void* memory;
+        std::size_t bytes;
+    };
+
+    // frees the oldest blocks until the cached bytes fit into the capacity
+    inline void trim() {
+        std::size_t count = 0;
+        for (; count < blocks_.size() && cached_bytes_ > capacity_; count++) {
+            BufferMemory::free(blocks_[count].memory);
+            cached_bytes_ -= blocks_[count].bytes;
+        }
+        blocks_.erase(blocks_.begin(), blocks_.begin() + count);
+    }
+
+    mutable std::mutex mutex_;
+    std::vector<Block> blocks_; // in release order
+    std::size_t capacity_;
+    std::size_t cached_bytes_;
+};
+
+// allocation options of GraphicsBuffer
+struct BufferAllocation {
+    // value-initialize the elements; when false, trivially copyable elements are left uninitialized,
+    // for buffers that are written before they are read
+    bool initialize = true;
+    // pad the row pitch of the linear layout so every row starts on a cache line
+    bool pad_rows = false;
+    // back storage of at least BufferMemory::HUGE_PAGE_SIZE bytes with transparent huge pages (Linux only)
+    bool huge_pages = false;
+    // take the memory from this pool and give it back on destruction, nullptr allocates from the heap
+    std::shared_ptr<BufferPool> pool;
+};
+
+/**
+ * @brief A 2D buffer of pixels, stored in the memory layout Layout.
+ *
+ * getValue() and setValue() hide the addressing. Row pointers (operator[])
+ * are only available for the LinearLayout, the layout the Rasterizer
+ * renders into. Vectors passed to the constructors are row-major for every
+ * layout, and toLinear() or copyRowToLinear() convert a buffer back for
+ * output. TiledLayout and MortonLayout keep 2D neighbourhoods in the same
+ * cache lines, which helps reads with 2D locality like texture sampling.
+ *
+ * The storage starts on a BufferMemory::ALIGNMENT byte boundary.
+ * BufferAllocation adds padded rows, huge pages, uninitialized elements and
+ * memory reuse through a BufferPool.
+ *
+ * Usage example:
+ * @code
+ * auto texture = std::make_shared<q3::GraphicsBuffer<q3::RGBColor, q3::MortonLayout>>(*q3::loadBmpTexture("wall.bmp"));
+ * q3::GraphicsBuffer<q3::RGBColor> image = texture->toLinear();
+ * @endcode
+ */
+template<typename T, typename Layout = LinearLayout>
 class GraphicsBuffer {
 public:
-    GraphicsBuffer() : width_(0), height_(0), data_() {}
-    GraphicsBuffer(uint32_t width, uint32_t height) 
-        : width_(width), height_(height), data_(width * height, T()) {}
-    template<typename U>
-    GraphicsBuffer(uint32_t width, uint32_t height, U&& value) 
-        : width_(width), height_(height), data_(width * height, std::forward<U>(value)) {}
+    GraphicsBuffer() : width_(0), height_(0), layout_(), allocation_(), data_(nullptr), block_bytes_(0) {}
+    GraphicsBuffer(uint32_t width, uint32_t height) : GraphicsBuffer(width, height, BufferAllocation{}) {}
+    GraphicsBuffer(uint32_t width, uint32_t height, const BufferAllocation& allocation)
+        : width_(width), height_(height), layout_(width, height, rowAlignment(allocation)), allocation_(allocation), data_(nullptr), block_bytes_(0) {
+        allocate();
+        constructElements(allocation.initialize);
+    }
+    template<typename U, typename = std::enable_if_t<!std::is_same<std::decay_t<U>, BufferAllocation>::value>>
+    GraphicsBuffer(uint32_t width, uint32_t height, U&& value)
+        : width_(width), height_(height), layout_(width, height), allocation_(), data_(nullptr), block_bytes_(0) {
+        allocate();
+        std::uninitialized_fill_n(data_, layout_.size(), std::forward<U>(value));
+    }
     GraphicsBuffer(const std::vector<T>& data, uint32_t width, uint32_t height)
-        : width_(width), height_(height), data_(data) {
-        if (data_.size() != width * height) { throw std::invalid_argument("Data size does not match the specified width and height."); }
+        : width_(width), height_(height), layout_(width, height), allocation_(), data_(nullptr), block_bytes_(0) {
+        if (data.size() != static_cast<std::size_t>(width) * height) { throw std::invalid_argument("Data size does not match the specified width and height."); }
+        allocate();
+        constructElements(true);
+        for (uint32_t y = 0; y < height_; y++) { copyRowFromLinear(y, data.data() + static_cast<std::size_t>(y) * width_); }
+    }
+    // converts other to this layout
+    template<typename OtherLayout, typename = std::enable_if_t<!std::is_same<OtherLayout, Layout>::value>>
+    explicit GraphicsBuffer(const GraphicsBuffer<T, OtherLayout>& other)
+        : width_(other.getWidth()), height_(other.getHeight()), layout_(width_, height_), allocation_(), data_(nullptr), block_bytes_(0) {
+        allocate();
+        constructElements(true);
+        if constexpr (OtherLayout::LINEAR) {
+            for (uint32_t y = 0; y < height_; y++) { copyRowFromLinear(y, other[y]); }
+        } else if constexpr (Layout::LINEAR) {
+            for (uint32_t y = 0; y < height_; y++) { other.copyRowToLinear(y, (*this)[y]); }
+        } else {
+            std::vector<T> row(width_);
+            for (uint32_t y = 0; y < height_; y++) {
+                other.copyRowToLinear(y, row.data());
+                copyRowFromLinear(y, row.data());
+            }
+        }
+    }
+    // copies keep the layout and the allocation options of other
+    GraphicsBuffer(const GraphicsBuffer& other)
+        : width_(other.width_), height_(other.height_), layout_(other.layout_), allocation_(other.allocation_), data_(nullptr), block_bytes_(0) {
+        allocate();
+        std::uninitialized_copy_n(other.data_, layout_.size(), data_);
+    }
+    GraphicsBuffer(GraphicsBuffer&& other) noexcept : GraphicsBuffer() { swap(other); }
+    GraphicsBuffer& operator=(const GraphicsBuffer& other) {
+        if (this != &other) {
+            GraphicsBuffer copy(other);
+            swap(copy);
+        }
+        return *this;
+    }
+    GraphicsBuffer& operator=(GraphicsBuffer&& other) noexcept {
+        GraphicsBuffer moved(std::move(other));
+        swap(moved);
+        return *this;
     }
-    GraphicsBuffer(std::vector<T>&& data, uint32_t width, uint32_t height)
-        : width_(width), height_(height), data_(std::move(data)) {
-        if (data_.size() != width * height) { throw std::invalid_argument("Data size does not match the specified width and height."); }
+    ~GraphicsBuffer() { release(); }
+
+    void swap(GraphicsBuffer& other) noexcept {
+        std::swap(width_, other.width_);
+        std::swap(height_, other.height_);
+        std::swap(layout_, other.layout_);
+        std::swap(allocation_, other.allocation_);
+        std::swap(data_, other.data_);
+        std::swap(block_bytes_, other.block_bytes_);
     }
 
-    T* operator[](uint32_t y) { return data_.data() + y * width_; }
-    const T* operator[](uint32_t y) const { return data_.data() + y * width_; }
+    T* operator[](uint32_t y) {
+        static_assert(Layout::LINEAR, "rows are only contiguous in the linear layout");
+        return data_ + layout_.index(0, y);
+    }
+    const T* operator[](uint32_t y) const {
+        static_assert(Layout::LINEAR, "rows are only contiguous in the linear layout");
+        return data_ + layout_.index(0, y);
+    }
 
     template<typename U>
-    void setValue(uint32_t x, uint32_t y, U&& value) { data_.data()[x + width_ * y] = std::forward<U>(value); }
-    T& getValue(uint32_t x, uint32_t y) { return data_.data()[x + width_ * y]; }
-    const T& getValue(uint32_t x, uint32_t y) const { return data_.data()[x + width_ * y]; }
+    void setValue(uint32_t x, uint32_t y, U&& value) { data_[layout_.index(x, y)] = std::forward<U>(value); }
+    T& getValue(uint32_t x, uint32_t y) { return data_[layout_.index(x, y)]; }
+    const T& getValue(uint32_t x, uint32_t y) const { return data_[layout_.index(x, y)]; }
 
     template<typename U>
-    void fill(U&& value) { std::fill(data_.begin(), data_.end(), std::forward<U>(value)); }
+    void fill(U&& value) { std::fill_n(data_, layout_.size(), std::forward<U>(value)); }
+
+    // copies the width pixels of row y to or from a row-major row
+    void copyRowToLinear(uint32_t y, T* row) const { layout_.rowToLinear(data_, y, row); }
+    void copyRowFromLinear(uint32_t y, const T* row) { layout_.rowFromLinear(data_, y, row); }
+    GraphicsBuffer<T> toLinear() const {
+        GraphicsBuffer<T> linear(width_, height_);
+        for (uint32_t y = 0; y < height_; y++) { copyRowToLinear(y, linear[y]); }
+        return linear;
+    }
 
     uint32_t getWidth() const { return width_; }
     uint32_t getHeight() const { return height_; }
-    T* getData() { return data_.data(); }
-    const T* getData() const { return data_.data(); }
+    const Layout& getLayout() const { return layout_; }
+    const BufferAllocation& getAllocation() const { return allocation_; }
+    // the storage in the order of the layout, getLayout().size() elements aligned to BufferMemory::ALIGNMENT bytes
+    T* getData() { return data_; }
+    const T* getData() const { return data_; }
 
 protected:
+    // trivially copyable elements need no construction, other types are constructed even when not initialized
+    static constexpr bool SKIP_CONSTRUCTION = std::is_trivially_copyable<T>::value && std::is_trivially_destructible<T>::value;
+
+    // row alignment in elements that makes every row start on a cache line
+    static uint32_t rowAlignment(const BufferAllocation& allocation) {
+        return allocation.pad_rows ? static_cast<uint32_t>(BufferMemory::ALIGNMENT / std::gcd(BufferMemory::ALIGNMENT, sizeof(T))) : 1;
+    }
+
+    void allocate() {
+        static_assert(alignof(T) <= BufferMemory::ALIGNMENT, "GraphicsBuffer storage is aligned to BufferMemory::ALIGNMENT");
+        if (layout_.size() == 0) return;
+        block_bytes_ = layout_.size() * sizeof(T);
+        void* memory = allocation_.pool != nullptr ? allocation_.pool->acquire(block_bytes_, allocation_.huge_pages)
+                                                   : BufferMemory::allocate(block_bytes_, allocation_.huge_pages);
+        data_ = static_cast<T*>(memory);
+    }
+
+    void constructElements(bool initialize) {
+        if (initialize) {
+            std::uninitialized_value_construct_n(data_, layout_.size());
+        } else if constexpr (!SKIP_CONSTRUCTION) {
+            std::uninitialized_default_construct_n(data_, layout_.size());
+        }
+    }
+
+    void release() {
+        if (data_ == nullptr) return;
+        std::destroy_n(data_, layout_.size());
+        if (allocation_.pool != nullptr) {
+            allocation_.pool->release(data_, block_bytes_);
+        } else {
+            BufferMemory::free(data_);
+        }
+        data_ = nullptr;
+    }
+
     uint32_t width_;
     uint32_t height_;
-    std::vector<T> data_;
+    Layout layout_;
+    BufferAllocation allocation_;
+    T* data_;
+    std::size_t block_bytes_;
 };
 
 template<typename T>
@@ -78,6 +500,19 @@ private:
     std::shared_ptr<DataBuffer<T>> buffer_;
 };
 
+// non-virtual sampler over a single buffer, used by the pipeline instantiated for a StaticShader
+// the pipeline passes the elements on as void pointers, StaticShader only reads them through const references
+template<typename T>
+class StaticDataBufferSampler {
+public:
+    explicit StaticDataBufferSampler(const DataBuffer<T>& buffer) : buffer_(buffer) {}
+
+    inline void* getValue(uint32_t index) const { return const_cast<T*>(&buffer_[index]); }
+
+private:
+    const DataBuffer<T>& buffer_;
+};
+
 /**
  * @brief A flexible sampler for multiple data buffers of different types.
  *
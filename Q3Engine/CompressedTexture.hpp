@@ -0,0 +1,429 @@
+#pragma once
+
+#include "RGBColor.hpp"
+#include "Buffer.hpp"
+#include "Math.hpp"
+#include "Texture.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+namespace q3 {
+
+/**
+ * @brief Formats of 4x4 texel blocks, bit-compatible with the BC1 and BC3 (DXT1 and DXT5) formats of GPUs.
+ *
+ * A color block holds two RGB565 endpoints and a 2 bit index per texel into
+ * the palette of the endpoints and two colors between them. BC1 stores only
+ * the color block, a texel with alpha below 128 selects the transparent black
+ * of the three color palette. BC3 adds an alpha block with two 8 bit
+ * endpoints and a 3 bit index per texel into 8 alpha values between them.
+ */
+enum class BLOCK_FORMAT {
+    BC1, // 8 bytes per block, 0.5 bytes per texel, 1 bit alpha
+    BC3  // 16 bytes per block, 1 byte per texel, 8 bit alpha
+};
+
+inline uint32_t blockBytes(BLOCK_FORMAT format) { return format == BLOCK_FORMAT::BC1 ? 8 : 16; }
+
+inline uint16_t packRgb565(uint32_t r, uint32_t g, uint32_t b) {
+    return static_cast<uint16_t>((((r * 31 + 127) / 255) << 11) | (((g * 63 + 127) / 255) << 5) | ((b * 31 + 127) / 255));
+}
+
+// the 8 bit channels of the endpoint, the high bits are repeated in the low bits
+inline RGBColor unpackRgb565(uint16_t color) {
+    const uint32_t r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+    return RGBColor{static_cast<uint8_t>((r << 3) | (r >> 2)), static_cast<uint8_t>((g << 2) | (g >> 4)), static_cast<uint8_t>((b << 3) | (b >> 2)), 255};
+}
+
+// palette of a color block, three colors and transparent black if color0 <= color1 and allow_three_colors is set
+inline void colorBlockPalette(uint16_t color0, uint16_t color1, bool allow_three_colors, RGBColor* palette) {
+    const RGBColor c0 = unpackRgb565(color0);
+    const RGBColor c1 = unpackRgb565(color1);
+    palette[0] = c0;
+    palette[1] = c1;
+    auto mix = [](uint8_t a, uint8_t b, uint32_t wa, uint32_t wb) { return static_cast<uint8_t>((a * wa + b * wb) / (wa + wb)); };
+    if (color0 > color1 || !allow_three_colors) {
+        palette[2] = RGBColor{mix(c0.r, c1.r, 2, 1), mix(c0.g, c1.g, 2, 1), mix(c0.b, c1.b, 2, 1), 255};
+        palette[3] = RGBColor{mix(c0.r, c1.r, 1, 2), mix(c0.g, c1.g, 1, 2), mix(c0.b, c1.b, 1, 2), 255};
+    } else {
+        palette[2] = RGBColor{mix(c0.r, c1.r, 1, 1), mix(c0.g, c1.g, 1, 1), mix(c0.b, c1.b, 1, 1), 255};
+        palette[3] = RGBColor{0, 0, 0, 0};
+    }
+}
+
+// palette of an alpha block, 8 interpolated values if alpha0 > alpha1, otherwise 6 and the values 0 and 255
+inline void alphaBlockPalette(uint8_t alpha0, uint8_t alpha1, uint8_t* palette) {
+    palette[0] = alpha0;
+    palette[1] = alpha1;
+    if (alpha0 > alpha1) {
+        for (uint32_t i = 1; i < 7; i++) { palette[i + 1] = static_cast<uint8_t>(((7 - i) * alpha0 + i * alpha1) / 7); }
+    } else {
+        for (uint32_t i = 1; i < 5; i++) { palette[i + 1] = static_cast<uint8_t>(((5 - i) * alpha0 + i * alpha1) / 5); }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+/**
+ * @brief Encodes the 16 texels (row-major) of a block into the 8 bytes of a color block.
+ *
+ * The endpoints are the extremes of the texels along their principal axis,
+ * every texel picks the nearest color of the palette. With punch_through,
+ * texels with alpha below 128 are encoded as transparent black with the three
+ * color palette; BC3 blocks pass false, their color block always uses four
+ * colors.
+ */
+inline void encodeColorBlock(const RGBColor* texels, bool punch_through, uint8_t* block) {
+    bool transparent[16];
+    uint32_t opaque_count = 0;
+    float mean[3] = {0.0f, 0.0f, 0.0f};
+    for (uint32_t i = 0; i < 16; i++) {
+        transparent[i] = punch_through && texels[i].a < 128;
+        if (transparent[i]) continue;
+        mean[0] += texels[i].r;
+        mean[1] += texels[i].g;
+        mean[2] += texels[i].b;
+        opaque_count++;
+    }
+    uint16_t color0 = 0, color1 = 0;
+    if (opaque_count > 0) {
+        for (float& m : mean) { m /= static_cast<float>(opaque_count); }
+        // covariance of the opaque texels, its dominant eigenvector by power iteration
+        float covariance[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+        for (uint32_t i = 0; i < 16; i++) {
+            if (transparent[i]) continue;
+            const float r = texels[i].r - mean[0], g = texels[i].g - mean[1], b = texels[i].b - mean[2];
+            covariance[0] += r * r;
+            covariance[1] += r * g;
+            covariance[2] += r * b;
+            covariance[3] += g * g;
+            covariance[4] += g * b;
+            covariance[5] += b * b;
+        }
+        float axis[3] = {1.0f, 1.0f, 1.0f};
+        for (uint32_t iteration = 0; iteration < 4; iteration++) {
+            const float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+            const float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+            const float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+            const float length = std::max({std::fabs(x), std::fabs(y), std::fabs(z)});
+            if (length == 0.0f) break;
+            axis[0] = x / length;
+            axis[1] = y / length;
+            axis[2] = z / length;
+        }
+        uint32_t min_texel = 0, max_texel = 0;
+        float min_projection = 1e30f, max_projection = -1e30f;
+        for (uint32_t i = 0; i < 16; i++) {
+            if (transparent[i]) continue;
+            const float projection = texels[i].r * axis[0] + texels[i].g * axis[1] + texels[i].b * axis[2];
+            if (projection < min_projection) { min_projection = projection; min_texel = i; }
+            if (projection > max_projection) { max_projection = projection; max_texel = i; }
+        }
+        color0 = packRgb565(texels[max_texel].r, texels[max_texel].g, texels[max_texel].b);
+        color1 = packRgb565(texels[min_texel].r, texels[min_texel].g, texels[min_texel].b);
+    }
+    // the order of the endpoints selects the palette
+    const bool three_colors = opaque_count < 16;
+    if (three_colors ? color0 > color1 : color0 < color1) { std::swap(color0, color1); }
+    RGBColor palette[4];
+    colorBlockPalette(color0, color1, true, palette);
+    // equal endpoints select the three color palette, whose first color is the endpoint as well
+    const uint32_t palette_colors = three_colors || color0 == color1 ? 3 : 4;
+    uint32_t indices = 0;
+    for (uint32_t i = 0; i < 16; i++) {
+        uint32_t best = 3;
+        if (!transparent[i]) {
+            int32_t best_error = INT32_MAX;
+            for (uint32_t p = 0; p < palette_colors; p++) {
+                const int32_t r = texels[i].r - palette[p].r, g = texels[i].g - palette[p].g, b = texels[i].b - palette[p].b;
+                const int32_t error = r * r + g * g + b * b;
+                if (error < best_error) { best_error = error; best = p; }
+            }
+        }
+        indices |= best << (2 * i);
+    }
+    block[0] = static_cast<uint8_t>(color0);
+    block[1] = static_cast<uint8_t>(color0 >> 8);
+    block[2] = static_cast<uint8_t>(color1);
+    block[3] = static_cast<uint8_t>(color1 >> 8);
+    for (uint32_t i = 0; i < 4; i++) { block[4 + i] = static_cast<uint8_t>(indices >> (8 * i)); }
+}
+
+// encodes the alpha of the 16 texels of a block into the 8 bytes of an alpha block with the 8 value palette
+inline void encodeAlphaBlock(const RGBColor* texels, uint8_t* block) {
+    uint8_t alpha0 = 0, alpha1 = 255;
+    for (uint32_t i = 0; i < 16; i++) {
+        alpha0 = std::max(alpha0, texels[i].a);
+        alpha1 = std::min(alpha1, texels[i].a);
+    }
+    uint8_t palette[8];
+    alphaBlockPalette(alpha0, alpha1, palette);
+    uint64_t indices = 0;
+    if (alpha0 != alpha1) {
+        for (uint32_t i = 0; i < 16; i++) {
+            uint64_t best = 0;
+            int32_t best_error = 256;
+            for (uint32_t p = 0; p < 8; p++) {
+                const int32_t error = std::abs(texels[i].a - palette[p]);
+                if (error < best_error) { best_error = error; best = p; }
+            }
+            indices |= best << (3 * i);
+        }
+    }
+    block[0] = alpha0;
+    block[1] = alpha1;
+    for (uint32_t i = 0; i < 6; i++) { block[2 + i] = static_cast<uint8_t>(indices >> (8 * i)); }
+}
+
+inline void decodeColorBlock(const uint8_t* block, bool allow_three_colors, RGBColor* texels) {
+    const uint16_t color0 = static_cast<uint16_t>(block[0] | (block[1] << 8));
+    const uint16_t color1 = static_cast<uint16_t>(block[2] | (block[3] << 8));
+    RGBColor palette[4];
+    colorBlockPalette(color0, color1, allow_three_colors, palette);
+    const uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) | (static_cast<uint32_t>(block[7]) << 24);
+    for (uint32_t i = 0; i < 16; i++) { texels[i] = palette[(indices >> (2 * i)) & 3]; }
+}
+
+// replaces the alpha of the decoded texels
+inline void decodeAlphaBlock(const uint8_t* block, RGBColor* texels) {
+    uint8_t palette[8];
+    alphaBlockPalette(block[0], block[1], palette);
+    uint64_t indices = 0;
+    for (uint32_t i = 0; i < 6; i++) { indices |= static_cast<uint64_t>(block[2 + i]) << (8 * i); }
+    for (uint32_t i = 0; i < 16; i++) { texels[i].a = palette[(indices >> (3 * i)) & 7]; }
+}
+
+/**
+ * @brief An image stored in 4x4 texel blocks of a BLOCK_FORMAT.
+ *
+ * encode() compresses a GraphicsBuffer at load time, write() and read() store
+ * the blocks in a file for offline compression. Blocks are stored in
+ * row-major order, the blocks of the last row and column are padded by
+ * repeating the border texels. getValue() decodes through the per-thread
+ * DecodedBlockCache, so the texels of a block are decoded once while a thread
+ * samples around it. Images are immutable once encoded.
+ */
+class CompressedImage {
+public:
+    static constexpr uint32_t BLOCK_SIZE = 4;
+
+    template<typename Layout>
+    static std::shared_ptr<CompressedImage> encode(const GraphicsBuffer<RGBColor, Layout>& image, BLOCK_FORMAT format) {
+        auto compressed = std::shared_ptr<CompressedImage>(new CompressedImage(image.getWidth(), image.getHeight(), format));
+        const uint32_t bytes = blockBytes(format);
+        RGBColor texels[BLOCK_SIZE * BLOCK_SIZE];
+        for (uint32_t block_y = 0; block_y < compressed->blocks_y_; block_y++) {
+            for (uint32_t block_x = 0; block_x < compressed->blocks_x_; block_x++) {
+                for (uint32_t i = 0; i < BLOCK_SIZE * BLOCK_SIZE; i++) {
+                    const uint32_t x = std::min(block_x * BLOCK_SIZE + i % BLOCK_SIZE, image.getWidth() - 1);
+                    const uint32_t y = std::min(block_y * BLOCK_SIZE + i / BLOCK_SIZE, image.getHeight() - 1);
+                    texels[i] = image.getValue(x, y);
+                }
+                uint8_t* block = compressed->data_.data() + (static_cast<std::size_t>(block_y) * compressed->blocks_x_ + block_x) * bytes;
+                if (format == BLOCK_FORMAT::BC1) {
+                    encodeColorBlock(texels, true, block);
+                } else {
+                    encodeAlphaBlock(texels, block);
+                    encodeColorBlock(texels, false, block + 8);
+                }
+            }
+        }
+        return compressed;
+    }
+
+    // reads an image written by write()
+    static std::shared_ptr<CompressedImage> read(std::istream& stream) {
+        uint32_t header[4];
+        stream.read(reinterpret_cast<char*>(header), sizeof(header));
+        if (!stream || header[0] != MAGIC || header[3] > static_cast<uint32_t>(BLOCK_FORMAT::BC3)) {
+            throw std::runtime_error("Invalid compressed image");
+        }
+        auto compressed = std::shared_ptr<CompressedImage>(new CompressedImage(header[1], header[2], static_cast<BLOCK_FORMAT>(header[3])));
+        stream.read(reinterpret_cast<char*>(compressed->data_.data()), static_cast<std::streamsize>(compressed->data_.size()));
+        if (!stream) { throw std::runtime_error("Failed to read compressed image"); }
+        return compressed;
+    }
+
+    // a header of magic, width, height and format as 32 bit integers in native byte order, followed by the blocks
+    void write(std::ostream& stream) const {
+        const uint32_t header[4] = {MAGIC, width_, height_, static_cast<uint32_t>(format_)};
+        stream.write(reinterpret_cast<const char*>(header), sizeof(header));
+        stream.write(reinterpret_cast<const char*>(data_.data()), static_cast<std::streamsize>(data_.size()));
+        if (!stream) { throw std::runtime_error("Failed to write compressed image"); }
+    }
+
+    // decodes the 16 texels of a block in row-major order
+    inline void decodeBlock(uint32_t block_x, uint32_t block_y, RGBColor* texels) const {
+        const uint8_t* block = data_.data() + (static_cast<std::size_t>(block_y) * blocks_x_ + block_x) * blockBytes(format_);
+        if (format_ == BLOCK_FORMAT::BC1) {
+            decodeColorBlock(block, true, texels);
+        } else {
+            decodeColorBlock(block + 8, false, texels);
+            decodeAlphaBlock(block, texels);
+        }
+    }
+
+    // texel (x, y) through the DecodedBlockCache of the calling thread
+    inline RGBColor getValue(uint32_t x, uint32_t y) const;
+
+    uint32_t getWidth() const { return width_; }
+    uint32_t getHeight() const { return height_; }
+    BLOCK_FORMAT getFormat() const { return format_; }
+    uint32_t getBlocksX() const { return blocks_x_; }
+    uint32_t getBlocksY() const { return blocks_y_; }
+    // bytes of the blocks, compared to width * height * 4 bytes of a GraphicsBuffer<RGBColor>
+    std::size_t getSizeInBytes() const { return data_.size(); }
+    const uint8_t* getData() const { return data_.data(); }
+    // unique per encoded or read image, tags its blocks in the DecodedBlockCache
+    uint64_t getId() const { return id_; }
+
+private:
+    static constexpr uint32_t MAGIC = 0x31504d43; // "CMP1"
+
+    CompressedImage(uint32_t width, uint32_t height, BLOCK_FORMAT format)
+        : width_(width), height_(height), blocks_x_((width + BLOCK_SIZE - 1) / BLOCK_SIZE), blocks_y_((height + BLOCK_SIZE - 1) / BLOCK_SIZE),
+          format_(format), id_(nextId()) {
+        if (width == 0 || height == 0) { throw std::invalid_argument("compressed images must not be empty"); }
+        data_.resize(static_cast<std::size_t>(blocks_x_) * blocks_y_ * blockBytes(format));
+    }
+
+    static uint64_t nextId() {
+        // 0 marks the empty entries of the cache
+        static std::atomic<uint64_t> next_id{1};
+        return next_id.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint32_t width_, height_;
+    uint32_t blocks_x_, blocks_y_;
+    BLOCK_FORMAT format_;
+    uint64_t id_;
+    std::vector<uint8_t> data_;
+};
+
+/**
+ * @brief The decoded blocks a thread sampled last, direct mapped by block position.
+ *
+ * Every thread has its own cache, so lookups take no locks. ENTRIES blocks
+ * cover a 32x32 texel window of one image; the image id is mixed into the
+ * slot so two textures sampled in turn do not evict each other on every
+ * sample. The cache is zero-initialized thread_local storage without
+ * constructors, empty entries hold the image id 0.
+ */
+class DecodedBlockCache {
+public:
+    static constexpr uint32_t ENTRIES = 64;
+
+    static DecodedBlockCache& local() {
+        static thread_local DecodedBlockCache cache;
+        return cache;
+    }
+
+    inline const RGBColor* lookup(const CompressedImage& image, uint32_t block_x, uint32_t block_y) {
+        const uint64_t id = image.getId();
+        const uint32_t block = block_y * image.getBlocksX() + block_x;
+        Entry& entry = entries_[((block_x & 7) | ((block_y & 7) << 3)) ^ (static_cast<uint32_t>(id * 0x9e3779b9u) >> 26)];
+        if (entry.image_id != id || entry.block != block) {
+            image.decodeBlock(block_x, block_y, entry.texels);
+            entry.image_id = id;
+            entry.block = block;
+            misses_++;
+        } else {
+            hits_++;
+        }
+        return entry.texels;
+    }
+
+    // statistics of the calling thread since the last resetStatistics()
+    uint64_t getHits() const { return hits_; }
+    uint64_t getMisses() const { return misses_; }
+    void resetStatistics() { hits_ = misses_ = 0; }
+
+private:
+    struct Entry {
+        uint64_t image_id;
+        uint32_t block;
+        RGBColor texels[CompressedImage::BLOCK_SIZE * CompressedImage::BLOCK_SIZE];
+    };
+
+    Entry entries_[ENTRIES];
+    uint64_t hits_;
+    uint64_t misses_;
+};
+
+inline RGBColor CompressedImage::getValue(uint32_t x, uint32_t y) const {
+    const RGBColor* texels = DecodedBlockCache::local().lookup(*this, x / BLOCK_SIZE, y / BLOCK_SIZE);
+    return texels[(y % BLOCK_SIZE) * BLOCK_SIZE + x % BLOCK_SIZE];
+}
+
+/**
+ * @brief A texture stored in CompressedImage levels, sampled like TextureT.
+ *
+ * The filters and the mip level selection are those of TextureT, the texels
+ * are decoded on sample through the DecodedBlockCache. Construct it from a
+ * TextureT to compress its image and every level of generateMipmaps().
+ */
+class CompressedTexture {
+public:
+    using FILTER = Texture::FILTER;
+
+    CompressedTexture() : filter_(FILTER::NEAREST) {}
+    explicit CompressedTexture(std::shared_ptr<CompressedImage> image) : levels_{std::move(image)}, filter_(FILTER::NEAREST) {}
+    template<typename Layout>
+    CompressedTexture(const TextureT<Layout>& texture, BLOCK_FORMAT format) : filter_(static_cast<FILTER>(texture.getFilter())) {
+        for (uint32_t level = 0; level < texture.getLevelCount(); level++) { levels_.push_back(CompressedImage::encode(*texture.getLevel(level), format)); }
+    }
+
+    void setFilter(FILTER filter) { filter_ = filter; }
+    FILTER getFilter() const { return filter_; }
+
+    // appends the next smaller mip level
+    void addLevel(std::shared_ptr<CompressedImage> level) { levels_.push_back(std::move(level)); }
+    uint32_t getLevelCount() const { return static_cast<uint32_t>(levels_.size()); }
+    std::shared_ptr<CompressedImage> getLevel(uint32_t level) const { return levels_.at(level); }
+    // bytes of the blocks of all levels
+    std::size_t getSizeInBytes() const {
+        std::size_t bytes = 0;
+        for (const auto& level : levels_) { bytes += level->getSizeInBytes(); }
+        return bytes;
+    }
+
+    inline RGBColor sample(const Vector2& uv) const { return sample(uv.x, uv.y); }
+    inline RGBColor sample(float u, float v) const {
+        return filter_ == FILTER::NEAREST ? sampleNearest(*levels_[0], u, v) : sampleBilinear(*levels_[0], u, v);
+    }
+
+    // like TextureT::sample(uv, ddx, ddy)
+    inline RGBColor sample(const Vector2& uv, const Vector2& ddx, const Vector2& ddy) const {
+        return sampleLevel(uv, mipLevel(levels_[0]->getWidth(), levels_[0]->getHeight(), ddx, ddy));
+    }
+
+    inline RGBColor sampleLevel(const Vector2& uv, float level) const {
+        const float max_level = static_cast<float>(levels_.size() - 1);
+        level = std::min(std::max(level, 0.0f), max_level);
+        if (filter_ != FILTER::TRILINEAR) {
+            const CompressedImage& image = *levels_[static_cast<uint32_t>(level + 0.5f)];
+            return filter_ == FILTER::NEAREST ? sampleNearest(image, uv.x, uv.y) : sampleBilinear(image, uv.x, uv.y);
+        }
+        const uint32_t level0 = static_cast<uint32_t>(level);
+        const RGBColor c0 = sampleBilinear(*levels_[level0], uv.x, uv.y);
+        if (level0 + 1 == levels_.size()) return c0;
+        const RGBColor c1 = sampleBilinear(*levels_[level0 + 1], uv.x, uv.y);
+        const float t = level - static_cast<float>(level0);
+        return RGBColor{lerpChannel(c0.r, c1.r, t), lerpChannel(c0.g, c1.g, t), lerpChannel(c0.b, c1.b, t), lerpChannel(c0.a, c1.a, t)};
+    }
+
+private:
+    std::vector<std::shared_ptr<CompressedImage>> levels_;
+    FILTER filter_;
+};
+
+}
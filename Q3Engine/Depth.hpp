@@ -0,0 +1,97 @@
+#pragma once
+
+#include "Simd.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace q3 {
+
+/**
+ * @brief Storage formats of a depth buffer, selected by its element type.
+ *
+ * - float: the depth as is, the default
+ * - uint16_t: 16 bit unorm, half the memory traffic of float
+ * - uint32_t: 24 bit unorm in the low bits with the high 8 bits zero, like
+ *   the D24X8 formats of GPUs; the same traffic as float but a uniform precision
+ *
+ * The rasterizer quantizes the depth of every fragment to the stored format
+ * before the depth test, so the test and the min/max reductions of the resolve
+ * and the hierarchical depth buffer compare stored values. Stored unorm values
+ * are below 2^24 and convert to float and back exactly, which lets the SIMD
+ * paths compare them as floats.
+ */
+template<typename T>
+struct DepthFormat;
+
+template<>
+struct DepthFormat<float> {
+    // stored value of depth z as float
+    static inline float quantize(float z) { return z; }
+    static inline float encode(float z) { return z; }
+    static inline float decode(float value) { return value; }
+#ifdef Q3_SSE2
+    static inline __m128 quantize4(__m128 z) { return z; }
+    // four stored values as floats
+    static inline __m128 load4(const float* values) { return _mm_loadu_ps(values); }
+#endif
+#ifdef Q3_AVX2
+    Q3_TARGET_AVX2 static inline __m256 quantize8(__m256 z) { return z; }
+    Q3_TARGET_AVX2 static inline __m256 load8(const float* values) { return _mm256_loadu_ps(values); }
+#endif
+};
+
+template<typename T, uint32_t Bits>
+struct UnormDepthFormat {
+    static_assert(Bits <= 24, "stored values must be exact in float");
+    static constexpr float SCALE = static_cast<float>((1u << Bits) - 1);
+
+    // nearest stored value of depth z as float, rounded to even like the SIMD versions,
+    // depths outside [0, 1] map outside the stored range
+    static inline float quantize(float z) {
+#ifdef Q3_SSE2
+        return static_cast<float>(_mm_cvtss_si32(_mm_set_ss(z * SCALE)));
+#else
+        return std::nearbyint(z * SCALE);
+#endif
+    }
+    // depths outside [0, 1] are clamped
+    static inline T encode(float z) { return static_cast<T>(quantize(std::min(std::max(z, 0.0f), 1.0f))); }
+    static inline float decode(T value) { return static_cast<float>(value) / SCALE; }
+#ifdef Q3_SSE2
+    static inline __m128 quantize4(__m128 z) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(z, _mm_set1_ps(SCALE)))); }
+#endif
+#ifdef Q3_AVX2
+    Q3_TARGET_AVX2 static inline __m256 quantize8(__m256 z) { return _mm256_cvtepi32_ps(_mm256_cvtps_epi32(_mm256_mul_ps(z, _mm256_set1_ps(SCALE)))); }
+#endif
+};
+
+template<>
+struct DepthFormat<uint16_t> : UnormDepthFormat<uint16_t, 16> {
+#ifdef Q3_SSE2
+    static inline __m128 load4(const uint16_t* values) {
+        __m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(values));
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, _mm_setzero_si128()));
+    }
+#endif
+#ifdef Q3_AVX2
+    Q3_TARGET_AVX2 static inline __m256 load8(const uint16_t* values) {
+        return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(values))));
+    }
+#endif
+};
+
+template<>
+struct DepthFormat<uint32_t> : UnormDepthFormat<uint32_t, 24> {
+#ifdef Q3_SSE2
+    static inline __m128 load4(const uint32_t* values) { return _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(values))); }
+#endif
+#ifdef Q3_AVX2
+    Q3_TARGET_AVX2 static inline __m256 load8(const uint32_t* values) {
+        return _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(values)));
+    }
+#endif
+};
+
+}
@@ -1,66 +1,610 @@
 #pragma once
 
+#include "Arena.hpp"
+#include "Blend.hpp"
 #include "Buffer.hpp"
+#include "Depth.hpp"
 #include "RGBColor.hpp"
 #include "Math.hpp"
 #include "Shader.hpp"
+#include "Simd.hpp"
+#include "ThreadPool.hpp"
 
 #include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
 #include <memory>
+#include <new>
 #include <stdexcept>
-
-#ifdef _WIN32
-#include <malloc.h>
-#else
-#include <alloca.h>
-#endif
+#include <type_traits>
+#include <vector>
 
 namespace q3 {
 
-class Rasterizer {
+// DepthT is the element type of the depth buffers: float, or uint16_t and uint32_t for the unorm formats of DepthFormat
+template<typename DepthT = float>
+class RasterizerT {
 public:
     enum class AA_MODE {
         NONE,
         SSAA_2X,
         SSAA_4X,
         SSAA_8X,
-        SSAA_16X
+        SSAA_16X,
+        // coverage and depth per sample, one fragment shader call per pixel and triangle
+        MSAA_2X,
+        MSAA_4X,
+        MSAA_8X
+    };
+
+    enum class FRAGMENT_MODE {
+        SCALAR, // one Shader::fragmentShader() call per pixel
+        BLOCK   // FragmentBlock::SIZE^2 pixel blocks, SIMD coverage and depth test, one Shader::fragmentShaderBlock() call per block
+                // MSAA modes always shade per pixel
+    };
+
+    enum class RASTER_MODE {
+        FLOAT,      // float coverage test at integer pixel coordinates
+        FIXED_POINT // vertices snapped to 1/256 pixel, integer coverage test at pixel centers with a top-left fill rule
+    };
+
+    // winding based culling, front faces are counter-clockwise in normalized device coordinates
+    enum class CULL_MODE {
+        NONE,
+        BACK,
+        FRONT
+    };
+
+    // counters of the last drawBuffer() call, pieces of clipped triangles count individually after the clipping stage
+    struct DrawStatistics {
+        uint64_t triangles = 0;        // submitted triangles
+        uint64_t shader_culled = 0;    // Shader::vertexShader() returned false
+        uint64_t frustum_culled = 0;   // outside the frustum, clipped away or outside the render target
+        uint64_t face_culled = 0;      // removed by the cull mode
+        uint64_t zero_area_culled = 0; // degenerate triangles
+        uint64_t small_culled = 0;     // triangles whose bounding box contains no pixel sample point
+        uint64_t clipped = 0;          // triangles cut by the clipping stage
+        uint64_t rasterized = 0;       // triangles and pieces handed to the raster stage
+
+        DrawStatistics& operator+=(const DrawStatistics& other) {
+            triangles += other.triangles;
+            shader_culled += other.shader_culled;
+            frustum_culled += other.frustum_culled;
+            face_culled += other.face_culled;
+            zero_area_culled += other.zero_area_culled;
+            small_culled += other.small_culled;
+            clipped += other.clipped;
+            rasterized += other.rasterized;
+            return *this;
+        }
     };
 
 public:
-    Rasterizer(std::shared_ptr<GraphicsBuffer<RGBColor>> framebuffer, std::shared_ptr<GraphicsBuffer<float>> depthbuffer)
-        : target_framebuffer_ptr_(nullptr), target_depthbuffer_ptr_(nullptr),
-          aa_mode_(AA_MODE::NONE) {
+    RasterizerT(std::shared_ptr<GraphicsBuffer<RGBColor>> framebuffer, std::shared_ptr<GraphicsBuffer<DepthT>> depthbuffer)
+        : buffer_pool_(std::make_shared<BufferPool>()), target_framebuffer_ptr_(nullptr), target_depthbuffer_ptr_(nullptr), target_width_(0), target_height_(0), msaa_samples_(1),
+          aa_mode_(AA_MODE::NONE), raster_mode_(RASTER_MODE::FLOAT), fragment_mode_(FRAGMENT_MODE::SCALAR), simd_level_(detectSimdLevel()),
+          cull_mode_(CULL_MODE::NONE), blend_mode_(BLEND_MODE::ALPHA), zero_area_culling_(true), small_triangle_culling_(false),
+          thread_count_(1), tile_size_(64), tile_local_super_sampling_(false), resolve_depth_(true),
+          arenas_(1), bins_(nullptr), hierarchical_depth_(false), deferred_shading_(false), deferred_draw_count_(0),
+          vertex_cache_(nullptr), varying_storage_(nullptr), varying_stride_(0),
+          clear_tiles_x_(0), clear_tiles_y_(0), pending_clear_tiles_(0), clear_color_(0, 0, 0, 0), clear_depth_(0) {
         setBuffers(framebuffer, depthbuffer);
     }
 
-    inline void setBuffers(std::shared_ptr<GraphicsBuffer<RGBColor>> framebuffer, std::shared_ptr<GraphicsBuffer<float>> depthbuffer) {
+    inline void setBuffers(std::shared_ptr<GraphicsBuffer<RGBColor>> framebuffer, std::shared_ptr<GraphicsBuffer<DepthT>> depthbuffer) {
         if (framebuffer == nullptr) { throw std::runtime_error("framebuffer is nullptr"); }
         if (depthbuffer == nullptr) { throw std::runtime_error("depthbuffer is nullptr"); }
         if (framebuffer->getWidth() != depthbuffer->getWidth() || framebuffer->getHeight() != depthbuffer->getHeight()) {
             throw std::runtime_error("framebuffer and depthbuffer have different sizes");
         }
+        resolveVisibilityBuffer();
         framebuffer_ = framebuffer;
         depthbuffer_ = depthbuffer;
         updateSuperSampleBuffers();
     }
 
     std::shared_ptr<GraphicsBuffer<RGBColor>> getFramebuffer() const { return framebuffer_; }
-    std::shared_ptr<GraphicsBuffer<float>> getDepthbuffer() const { return depthbuffer_; }
+    std::shared_ptr<GraphicsBuffer<DepthT>> getDepthbuffer() const { return depthbuffer_; }
+    // keeps the memory of sample and scratch buffers released by AA mode and size changes for reuse
+    std::shared_ptr<BufferPool> getBufferPool() const { return buffer_pool_; }
 
+    /**
+     * @brief Clears the color of the render target.
+     *
+     * In the SSAA and MSAA modes (without tile-local supersampling) the clears
+     * of the sample buffers are lazy: they only flag the tiles of the render
+     * target. A tile is filled right before the first triangle touching it is
+     * rasterized, and the resolve writes the clear values of tiles that were
+     * never drawn without reading their samples.
+     */
     inline void clearFrameBuffer(const RGBColor& color = RGBColor{0, 0, 0, 0}) {
-        target_framebuffer_ptr_->fill(color);
+        resolveVisibilityBuffer();
+        if (!lazyClears()) {
+            target_framebuffer_ptr_->fill(color);
+            return;
+        }
+        clear_color_ = color;
+        flagClearTiles(CLEAR_COLOR);
     }
+    // the unorm depth formats clamp value to [0, 1], lazy in the same modes as clearFrameBuffer()
     inline void clearDepthBuffer(float value = 1.0f) {
-        target_depthbuffer_ptr_->fill(value);
+        resolveVisibilityBuffer();
+        const DepthT stored = Depth::encode(value);
+        hierarchical_depthbuffer_.fill(static_cast<float>(stored));
+        if (!lazyClears()) {
+            target_depthbuffer_ptr_->fill(stored);
+            return;
+        }
+        clear_depth_ = stored;
+        flagClearTiles(CLEAR_DEPTH);
     }
 
+    // the sample buffers of a new mode are undefined until the frame and depth buffers are cleared
     inline void setAntialiasingMode(AA_MODE mode) {
+        resolveVisibilityBuffer();
         aa_mode_ = mode;
         updateSuperSampleBuffers();
     }
 
+    inline void setCullMode(CULL_MODE mode) { cull_mode_ = mode; }
+    CULL_MODE getCullMode() const { return cull_mode_; }
+
+    // how fragments are combined with the framebuffer, in every mode fragments with alpha 0 are discarded
+    // and fragments with alpha 255 write depth
+    inline void setBlendMode(BLEND_MODE mode) {
+        resolveVisibilityBuffer();
+        blend_mode_ = mode;
+    }
+    BLEND_MODE getBlendMode() const { return blend_mode_; }
+
+    // rejects triangles with a doubled screen space area below 1e-3 pixels (on by default), otherwise only exactly degenerate ones
+    inline void setZeroAreaCulling(bool enabled) { zero_area_culling_ = enabled; }
+    bool getZeroAreaCulling() const { return zero_area_culling_; }
+
+    // rejects triangles whose bounding box contains no pixel sample point
+    inline void setSmallTriangleCulling(bool enabled) { small_triangle_culling_ = enabled; }
+    bool getSmallTriangleCulling() const { return small_triangle_culling_; }
+
+    const DrawStatistics& getDrawStatistics() const { return statistics_; }
+
+    /**
+     * @brief Selects how the raster stage decides which pixels a triangle covers.
+     *
+     * FIXED_POINT snaps the screen space vertices to SUB_PIXEL_BITS bits of
+     * sub-pixel precision and samples pixel centers with exact integer edge
+     * functions. The top-left fill rule makes every pixel on an edge shared by
+     * two triangles belong to exactly one of them, so meshes have neither
+     * cracks nor pixels shaded and blended twice. Barycentrics and depth are
+     * still interpolated in float at the pixel centers. The MSAA modes keep
+     * the float sample test.
+     */
+    inline void setRasterMode(RASTER_MODE mode) {
+        resolveVisibilityBuffer();
+        raster_mode_ = mode;
+    }
+    RASTER_MODE getRasterMode() const { return raster_mode_; }
+
+    inline void setFragmentMode(FRAGMENT_MODE mode) { fragment_mode_ = mode; }
+    FRAGMENT_MODE getFragmentMode() const { return fragment_mode_; }
+
+    // caps the instruction set used by the block fragment mode, never exceeds what the CPU supports
+    inline void setSimdLevel(SIMD_LEVEL level) { simd_level_ = std::min(level, detectSimdLevel()); }
+    SIMD_LEVEL getSimdLevel() const { return simd_level_; }
+
+    /**
+     * @brief Sets the number of threads used by drawBuffer().
+     *
+     * With a single thread (the default) triangles are drawn one by one on the
+     * calling thread. With more threads drawBuffer() runs the sort-middle tiled
+     * pipeline: triangles are transformed in parallel, binned into screen tiles
+     * in submission order, and the tiles are rasterized in parallel. Every pixel
+     * still sees the triangles in submission order, so the output is identical
+     * to the single-threaded path.
+     *
+     * @note In threaded mode Shader::vertexShader() and Shader::fragmentShader()
+     *       are called concurrently and must not modify shared state.
+     * @param thread_count number of threads, 0 selects std::thread::hardware_concurrency()
+     */
+    inline void setThreadCount(uint32_t thread_count) {
+        if (thread_count == 0) { thread_count = std::max(1u, std::thread::hardware_concurrency()); }
+        thread_count_ = thread_count;
+        thread_pool_ = thread_count_ > 1 ? std::make_unique<ThreadPool>(thread_count_) : nullptr;
+        // arenas are never dropped, pending deferred draws may still use them
+        while (arenas_.size() < thread_count_) { arenas_.emplace_back(); }
+    }
+    uint32_t getThreadCount() const { return thread_count_; }
+
+    /**
+     * @brief Most bytes the per-thread arenas held at once, summed over the threads.
+     *
+     * The shader contexts, the post-transform vertices and varyings, the bins
+     * and the setups of deferred draws are allocated from a linear arena per
+     * thread instead of the heap. The arenas are reset in O(1) whenever no
+     * draw uses them anymore: at the start of every draw without pending
+     * deferred draws, and by resolveVisibilityBuffer(). In the deferred mode
+     * and with tile-local supersampling they therefore hold a whole frame of
+     * draws.
+     */
+    std::size_t getArenaHighWaterMark() const {
+        std::size_t bytes = 0;
+        for (const LinearArena& arena : arenas_) { bytes += arena.getHighWaterMark(); }
+        return bytes;
+    }
+
+    // tile edge length in pixels of the render target used by the threaded pipeline
+    inline void setTileSize(uint32_t tile_size) {
+        if (tile_size == 0) { throw std::invalid_argument("tile size must be greater than 0"); }
+        tile_size_ = tile_size;
+    }
+    uint32_t getTileSize() const { return tile_size_; }
+
+    /**
+     * @brief Renders the SSAA modes tile by tile instead of into full resolution sample buffers.
+     *
+     * Draws only run their vertex stage and are kept like deferred draws
+     * until resolveVisibilityBuffer(). It bins all of them and rasterizes
+     * every tile of about getTileSize()^2 samples through the draws in
+     * submission order into a small scratch buffer of the drawing thread,
+     * then resolves the tile straight into the framebuffer. The memory of
+     * the sample buffers no longer grows with the sample count, and a frame
+     * gives the same image as the default path.
+     *
+     * Call resolveVisibilityBuffer() after the last draw of a frame; like in
+     * the deferred mode it also runs before a clear and any change of the
+     * render targets or modes. The samples of a tile start out as copies of
+     * their resolved pixel, so only draws after such a resolve see the edges
+     * of the earlier ones at pixel resolution. The shaders and the data
+     * passed to drawBuffer() must stay alive and unchanged until the resolve.
+     */
+    inline void setTileLocalSuperSampling(bool enabled) {
+        resolveVisibilityBuffer();
+        tile_local_super_sampling_ = enabled;
+        updateSuperSampleBuffers();
+    }
+    bool getTileLocalSuperSampling() const { return tile_local_super_sampling_; }
+
+    // resolve the depth of the SSAA and MSAA sample buffers into the depthbuffer after every draw (on by default),
+    // turn it off when the depthbuffer is not read afterwards; tile-local supersampling always resolves the depth
+    inline void setResolveDepth(bool enabled) { resolve_depth_ = enabled; }
+    bool getResolveDepth() const { return resolve_depth_; }
+
+    /**
+     * @brief Keeps a hierarchical depth buffer next to the depth buffer of the render target.
+     *
+     * It holds the farthest depth of every 8x8 pixel block. Triangles whose
+     * nearest depth lies behind all blocks of their bounding box are skipped
+     * without visiting a pixel, and blocks a triangle cannot reach in front of
+     * are skipped by every raster path. Blocks are refreshed after opaque
+     * fragments wrote depth, the output does not change. Tile-local
+     * supersampling does not use it.
+     *
+     * @note Call updateHierarchicalDepth() after writing the depth buffer
+     *       through getDepthbuffer() while the rasterizer keeps drawing into it.
+     */
+    inline void setHierarchicalDepth(bool enabled) {
+        hierarchical_depth_ = enabled;
+        updateHierarchicalDepth();
+    }
+    bool getHierarchicalDepth() const { return hierarchical_depth_; }
+
+    // rebuilds the hierarchical depth buffer from the depth buffer of the render target
+    inline void updateHierarchicalDepth() {
+        if (!useHierarchicalDepth()) {
+            hierarchical_depthbuffer_ = GraphicsBuffer<float>();
+            return;
+        }
+        const uint32_t blocks_x = (target_width_ + HIERARCHICAL_DEPTH_BLOCK_SIZE - 1) / HIERARCHICAL_DEPTH_BLOCK_SIZE;
+        const uint32_t blocks_y = (target_height_ + HIERARCHICAL_DEPTH_BLOCK_SIZE - 1) / HIERARCHICAL_DEPTH_BLOCK_SIZE;
+        if (hierarchical_depthbuffer_.getWidth() != blocks_x || hierarchical_depthbuffer_.getHeight() != blocks_y) {
+            hierarchical_depthbuffer_ = GraphicsBuffer<float>(blocks_x, blocks_y, scratchBufferAllocation());
+        }
+        writePendingClears(0, 0, static_cast<int32_t>(target_width_) - 1, static_cast<int32_t>(target_height_) - 1);
+        for (uint32_t by = 0; by < blocks_y; by++) {
+            refreshHierarchicalDepth(0, static_cast<int32_t>(blocks_x) - 1, static_cast<int32_t>(by));
+        }
+    }
+
+    /**
+     * @brief Enables the deferred (visibility buffer) mode for opaque draws.
+     *
+     * drawBuffer() then only rasterizes depth and, per pixel, the draw and
+     * triangle that are visible together with their barycentrics. The shading
+     * is deferred to resolveVisibilityBuffer(), which calls
+     * Shader::fragmentShader() exactly once per visible pixel, so hidden
+     * fragments are never shaded. Call it once all opaque draws are submitted;
+     * it also runs automatically before a forward draw, a clear and any change
+     * of the render targets or modes, so the output matches forward rendering.
+     *
+     * Draws whose Shader::isOpaque() returns false, the MSAA modes,
+     * tile-local supersampling and the blend modes in which opaque fragments
+     * do not replace the framebuffer color keep the forward path. The triangles, contexts
+     * and varyings of deferred draws are kept until the resolve, the shader and
+     * the data passed to drawBuffer() must stay alive and unchanged until then.
+     *
+     * @note Deferred draws write depth for every covered fragment, fragments
+     *       must not be discarded with alpha 0.
+     */
+    inline void setDeferredShading(bool enabled) {
+        resolveVisibilityBuffer();
+        deferred_shading_ = enabled;
+    }
+    bool getDeferredShading() const { return deferred_shading_; }
+
+    // shades the pixels of the pending deferred draws, or rasterizes the pending draws of tile-local supersampling,
+    // and resolves the sample buffers, does nothing without pending draws
+    inline void resolveVisibilityBuffer() {
+        if (deferred_draw_count_ == 0) return;
+        if (tileLocalSuperSampling()) {
+            rasterizeSuperSampleTiles();
+        } else {
+            shadeVisibilityBuffer();
+        }
+        // keep the storage of the draws for the next frame
+        for (uint32_t i = 0; i < deferred_draw_count_; i++) { deferred_draws_[i] = DeferredDraw{}; }
+        deferred_draw_count_ = 0;
+        resetArenas();
+        downSample();
+    }
+
     inline void drawBuffer(const DataBuffer<Vector3>& vertices, const DataBuffer<uint32_t>& indices, Shader& shader, BaseDataBufferSampler& sampler) {
+        drawBufferImpl(vertices, indices, shader, sampler, &shader, &shadeDeferred<Shader>, &rasterizeDeferredBin<Shader>);
+    }
+
+    /**
+     * @brief Draws with a shader type resolved at compile time.
+     *
+     * The pipeline is instantiated for ShaderT, so the shader calls are direct
+     * and inlined into the raster loops, and the shader works with typed data
+     * instead of void pointers. ShaderT declares the element type of
+     * attributes, which holds one element per vertex, and either a Context
+     * that its vertex shader fills per triangle:
+     *
+     * @code
+     * struct TextureShader {
+     *     using Attributes = q3::Vector2;
+     *     struct Context { q3::Vector2 uv0, uv1, uv2; };
+     *     bool vertexShader(q3::Vertex& v0, q3::Vertex& v1, q3::Vertex& v2,
+     *                       const Attributes& a0, const Attributes& a1, const Attributes& a2, Context& context);
+     *     q3::RGBColor fragmentShader(const q3::Triangle& triangle, const q3::Barycentric& barycentric, const Context& context);
+     * };
+     * @endcode
+     *
+     * or a Varying that its vertex shader fills once per vertex, like the
+     * per-vertex stage of Shader::hasPerVertexShader():
+     *
+     * @code
+     * struct GouraudShader {
+     *     using Attributes = q3::Vector3;
+     *     using Varying = q3::Vector3;
+     *     void vertexShader(q3::Vertex& v, const Attributes& attributes, Varying& varying);
+     *     q3::RGBColor fragmentShader(const q3::Triangle& triangle, const q3::Barycentric& barycentric,
+     *                                 const Varying& v0, const Varying& v1, const Varying& v2);
+     * };
+     * @endcode
+     *
+     * A fragment shader taking a single Varying receives it interpolated by the
+     * rasterizer, like Shader::interpolatesVaryings(); the Varying then
+     * consists of at most FragmentBlock::MAX_VARYINGS floats:
+     *
+     * @code
+     * struct TexturedShader {
+     *     using Attributes = q3::Vector2;
+     *     using Varying = q3::Vector2;
+     *     void vertexShader(q3::Vertex& v, const Attributes& attributes, Varying& varying);
+     *     q3::RGBColor fragmentShader(const q3::Triangle& triangle, const q3::Barycentric& barycentric, const Varying& uv);
+     * };
+     * @endcode
+     *
+     * Taking a `const q3::VaryingDerivatives<Varying>&` after it, the fragment
+     * shader also receives the derivatives d/dx and d/dy of the interpolated
+     * Varying, like Shader::needsVaryingDerivatives(), e.g. to choose the mip
+     * level of TextureT::sample(uv, ddx, ddy).
+     *
+     * An optional `bool isOpaque() const` works like Shader::isOpaque(). The
+     * output is identical to drawing the equivalent Shader, the virtual
+     * drawBuffer() stays for shaders chosen at run time.
+     */
+    template<typename ShaderT>
+    inline void drawBuffer(const DataBuffer<Vector3>& vertices, const DataBuffer<uint32_t>& indices, ShaderT& shader, const DataBuffer<typename ShaderT::Attributes>& attributes) {
+        if (attributes.size() < vertices.size()) { throw std::invalid_argument("attributes has fewer elements than vertices"); }
+        StaticShader<ShaderT> static_shader(shader);
+        StaticDataBufferSampler<typename ShaderT::Attributes> sampler(attributes);
+        drawBufferImpl(vertices, indices, static_shader, sampler, &shader, &shadeDeferred<ShaderT>, &rasterizeDeferredBin<ShaderT>);
+    }
+
+private:
+    struct TriangleSetup;
+    struct VaryingPlanes;
+    struct Bin;
+    struct RenderTarget;
+    // fragment shader call of resolveVisibilityBuffer() with screen space barycentrics of pixel (x, y), deferred draws keep their shader type-erased until then
+    // planes belong to the caller and are set up again for setup if new_triangle is true
+    using DeferredShadeFunc = RGBColor (*)(void* shader, const TriangleSetup& setup, VaryingPlanes& planes, bool new_triangle, const Barycentric& barycentric,
+                                           int32_t x, int32_t y);
+    // raster stage of a tile-local supersampling draw in resolveVisibilityBuffer(), rasterizes the triangles of bin inside [min_x, max_x] x [min_y, max_y]
+    using DeferredRasterFunc = void (*)(RasterizerT& rasterizer, void* shader, const Bin& bin, const RenderTarget& target, int32_t min_x, int32_t min_y,
+                                        int32_t max_x, int32_t max_y);
+
+    // ShaderT is Shader or a StaticShader, SamplerT provides void* getValue(uint32_t index) for the vertex stage
+    template<typename ShaderT, typename SamplerT>
+    inline void drawBufferImpl(const DataBuffer<Vector3>& vertices, const DataBuffer<uint32_t>& indices, ShaderT& shader, SamplerT& sampler,
+                               void* deferred_shader, DeferredShadeFunc deferred_shade, DeferredRasterFunc deferred_raster) {
+        if (shader.interpolatesVaryings() && (!shader.hasPerVertexShader() || shader.getVaryingSize() % sizeof(float) != 0 ||
+                                              shader.getVaryingSize() > FragmentBlock::MAX_VARYINGS * sizeof(float))) {
+            throw std::invalid_argument("interpolated varyings must be at most FragmentBlock::MAX_VARYINGS floats of a per-vertex shader");
+        }
+        if (shader.needsVaryingDerivatives() && !shader.interpolatesVaryings()) {
+            throw std::invalid_argument("varying derivatives require interpolated varyings");
+        }
+        if (deferred_draw_count_ == 0) { resetArenas(); }
+        statistics_ = DrawStatistics{};
+        statistics_.triangles = indices.size() / 3;
+        if (deferredShading(shader) || tileLocalSuperSampling()) {
+            // shaded or rasterized and resolved by resolveVisibilityBuffer()
+            drawBufferDeferred(vertices, indices, shader, sampler, deferred_shader, deferred_shade, deferred_raster);
+            return;
+        }
+        // forward draws blend over everything drawn before them
+        resolveVisibilityBuffer();
+        if (thread_pool_ != nullptr) {
+            drawBufferTiled(vertices, indices, shader, sampler);
+        } else {
+            drawBufferSerial(vertices, indices, shader, sampler);
+        }
+        downSample();
+    }
+
+    using Depth = DepthFormat<DepthT>;
+
+    // invalidates everything allocated from the arenas, only while no draw refers to it
+    inline void resetArenas() {
+        for (LinearArena& arena : arenas_) { arena.reset(); }
+        bins_ = nullptr;
+        vertex_cache_ = nullptr;
+        varying_storage_ = nullptr;
+    }
+
+    // number of triangles or vertices processed per job of the threaded pipeline
+    static constexpr uint32_t BATCH_SIZE = 256;
+    // clipping a triangle against the near plane and the four guard band planes yields at most 8 vertices
+    static constexpr uint32_t MAX_CLIPPED_TRIANGLES = 6;
+    static constexpr uint32_t NO_DRAW = std::numeric_limits<uint32_t>::max();
+    // sub-pixel precision of the fixed point raster mode
+    static constexpr int32_t SUB_PIXEL_BITS = 8;
+    static constexpr int32_t SUB_PIXEL_SCALE = 1 << SUB_PIXEL_BITS;
+    // pixels per edge of a hierarchical depth block, matches the blocks of the block fragment mode
+    static constexpr uint32_t HIERARCHICAL_DEPTH_BLOCK_SIZE = 8;
+    // depth rejection only happens beyond this margin, so rounding never rejects a fragment the exact test would keep
+    static constexpr float HIERARCHICAL_DEPTH_TOLERANCE = 1e-5f;
+    // span and block coverage tests only reject below this margin, so rounding never rejects a pixel the exact per-pixel test would keep
+    static constexpr float COVERAGE_TOLERANCE = 1e-4f;
+    // edge in render target pixels of the tiles of the lazy clears, a multiple of every SSAA factor
+    static constexpr uint32_t CLEAR_TILE_SIZE = 64;
+    // clears of a tile that are still pending
+    static constexpr uint8_t CLEAR_COLOR = 1 << 0;
+    static constexpr uint8_t CLEAR_DEPTH = 1 << 1;
+    static constexpr uint8_t CLEAR_QUEUED = 1 << 2;
+    // largest samples per pixel edge of the SSAA modes
+    static constexpr uint32_t MAX_SUPER_SAMPLE_FACTOR = 16;
+    // guard band in NDC units, triangles inside it are not clipped against the side planes
+    static constexpr float GUARD_BAND = 8.0f;
+    // clip space planes, used as outcode bits
+    static constexpr uint32_t CLIP_LEFT = 1 << 0;
+    static constexpr uint32_t CLIP_RIGHT = 1 << 1;
+    static constexpr uint32_t CLIP_BOTTOM = 1 << 2;
+    static constexpr uint32_t CLIP_TOP = 1 << 3;
+    static constexpr uint32_t CLIP_NEAR = 1 << 4;
+    static constexpr uint32_t CLIP_FAR = 1 << 5;
+
+    // a triangle after the vertex stage, ready to be rasterized
+    struct TriangleSetup {
+        Vertex v0, v1, v2; // screen space
+        Triangle triangle;
+        void* data0;
+        void* data1;
+        void* data2;
+        void* context;
+        // inclusive screen space bounding box, clamped to the render target
+        int32_t bbox_min_x, bbox_min_y, bbox_max_x, bbox_max_y;
+        // barycentric plane equations relative to v0: l1 = l1_dx * (x - v0.x) + l1_dy * (y - v0.y), same for l2
+        float l1_dx, l1_dy;
+        float l2_dx, l2_dy;
+        // fixed point mode: integer edge functions of the edges opposite to v0, v1 and v2 at the center of pixel (x, y)
+        // are edge_c + edge_dx * x + edge_dy * y, positive inside and biased by -1 on edges that are not top or left
+        bool fixed_point;
+        int64_t edge_c[3], edge_dx[3], edge_dy[3];
+        // depth plane z = v0.z + z_dx * (x - v0.x) + z_dy * (y - v0.y) and the smallest vertex depth
+        float z_dx, z_dy;
+        float min_z;
+        // set for pieces of a triangle cut by the clipping stage, the barycentrics of the piece are mapped
+        // to perspective-correct barycentrics of the original triangle: l = sum(l_i * clip_weights[i]) / sum(l_i * (1 / w_i))
+        bool clipped;
+        Vector3 clip_weights[3]; // original barycentrics of the piece's vertices, pre-multiplied by their 1 / w
+    };
+
+    // a pixel of the visibility buffer, the triangle of a deferred draw that is visible and its screen space barycentrics
+    struct VisibilitySample {
+        uint32_t draw;     // NO_DRAW for pixels without deferred triangle
+        uint32_t triangle; // index into DeferredDraw::setups
+        float l1, l2;
+    };
+
+    // the triangles of a raster tile in submission order
+    struct Bin {
+        const TriangleSetup** setups;
+        uint32_t count;
+    };
+
+    // a draw of the deferred mode or of tile-local supersampling waiting for resolveVisibilityBuffer()
+    // the setups and everything they point to live in the arenas, which are not reset while a deferred draw is pending
+    struct DeferredDraw {
+        void* shader;
+        DeferredShadeFunc shade;
+        DeferredRasterFunc raster;
+        const TriangleSetup* setups;
+        uint32_t setup_count;
+        const Bin* bins; // tile-local supersampling: the setups binned into the tiles of the resolve
+    };
+
+    // buffers written by the raster stage, pixel (x, y) of the render target is stored at (x - origin_x, y - origin_y)
+    struct RenderTarget {
+        GraphicsBuffer<RGBColor>* framebuffer;
+        GraphicsBuffer<DepthT>* depthbuffer;
+        int32_t origin_x, origin_y;
+    };
+
+    // hierarchical depth blocks of one block row that received depth writes
+    struct DirtyBlocks {
+        int32_t min_bx = std::numeric_limits<int32_t>::max();
+        int32_t max_bx = -1;
+        int32_t by = 0;
+
+        void mark(int32_t x, int32_t y) {
+            min_bx = std::min(min_bx, x / static_cast<int32_t>(HIERARCHICAL_DEPTH_BLOCK_SIZE));
+            max_bx = std::max(max_bx, x / static_cast<int32_t>(HIERARCHICAL_DEPTH_BLOCK_SIZE));
+            by = y / static_cast<int32_t>(HIERARCHICAL_DEPTH_BLOCK_SIZE);
+        }
+    };
+
+    // a vertex of the clipping stage, weights are its barycentrics relative to the original triangle
+    struct ClipVertex {
+        Vertex position;
+        Vector3 weights;
+    };
+
+    // one FragmentBlock::SIZE pixel row of a block, starting at pixel x
+    struct BlockRow {
+        int32_t x;
+        float v0_x;
+        // barycentrics at x = v0.x of the row
+        float l1_row, l2_row;
+        float l1_dx, l2_dx;
+        // screen space depth of the vertices
+        float z0, z1, z2;
+        // false if lane_mask already holds the coverage of the fixed point mode
+        bool test_coverage;
+    };
+
+    // reference path: draws the triangles one by one on the calling thread
+    template<typename ShaderT, typename SamplerT>
+    inline void drawBufferSerial(const DataBuffer<Vector3>& vertices, const DataBuffer<uint32_t>& indices, ShaderT& shader, SamplerT& sampler) {
+        if (shader.hasPerVertexShader()) {
+            const RenderTarget target{target_framebuffer_ptr_, target_depthbuffer_ptr_, 0, 0};
+            shadeVertices(vertices, indices, shader, sampler);
+            for (size_t i = 0; i < indices.size(); i += 3) {
+                TriangleSetup setups[MAX_CLIPPED_TRIANGLES];
+                uint32_t setup_count = setupCachedTriangle(indices[i], indices[i + 1], indices[i + 2], setups, statistics_);
+                for (uint32_t k = 0; k < setup_count; k++) {
+                    writePendingClears(setups[k].bbox_min_x, setups[k].bbox_min_y, setups[k].bbox_max_x, setups[k].bbox_max_y);
+                    rasterizeTriangle(setups[k], shader, target, 0, 0, std::numeric_limits<int32_t>::max(), std::numeric_limits<int32_t>::max());
+                }
+            }
+            return;
+        }
+        // one context for all triangles, each is rasterized before the next one is set up
+        void* context = arenas_[0].allocate(shader.getContextSize());
         for (size_t i = 0; i < indices.size(); i += 3) {
             uint32_t i0 = indices[i];
             uint32_t i1 = indices[i + 1];
@@ -71,73 +615,1475 @@ public:
             void* data0 = sampler.getValue(i0);
             void* data1 = sampler.getValue(i1);
             void* data2 = sampler.getValue(i2);
-            drawTriangle(v0, v1, v2, shader, data0, data1, data2);
+            drawTriangle(v0, v1, v2, shader, data0, data1, data2, context);
         }
-        downSample();
     }
 
-private:
-    inline RGBColor alphaBlend(const RGBColor& src, const RGBColor& dst) {
-        float src_alpha = src.a / 255.0f;
-        float inv_alpha = 1.0f - src_alpha;
+    // sort-middle path: parallel vertex stage, binning into tiles, parallel rasterization per tile
+    // with a deferred draw the raster stage only writes depth and the visibility buffer, with tile-local supersampling it waits for the resolve
+    template<typename ShaderT, typename SamplerT>
+    inline void drawBufferTiled(const DataBuffer<Vector3>& vertices, const DataBuffer<uint32_t>& indices, ShaderT& shader, SamplerT& sampler,
+                                DeferredDraw* deferred_draw = nullptr) {
+        const uint32_t triangle_count = static_cast<uint32_t>(indices.size() / 3);
+        if (triangle_count == 0) return;
+        const bool per_vertex = shader.hasPerVertexShader();
+        // contexts must outlive the vertex stage, every batch allocates them from the arena of its thread
+        const std::size_t context_stride = per_vertex ? 0 : alignedStorageSize(shader.getContextSize());
+        if (per_vertex) { shadeVertices(vertices, indices, shader, sampler); }
+
+        // vertex stage
+        // every batch collects the setups of its triangles (and of their clipped pieces) in submission order
+        const uint32_t batch_count = (triangle_count + BATCH_SIZE - 1) / BATCH_SIZE;
+        batch_setups_.resize(batch_count);
+        thread_statistics_.assign(thread_count_, DrawStatistics{});
+        parallelFor(batch_count, [&](uint32_t batch, uint32_t thread_index) {
+            std::vector<TriangleSetup>& batch_setups = batch_setups_[batch];
+            DrawStatistics& statistics = thread_statistics_[thread_index];
+            batch_setups.clear();
+            uint32_t end = std::min(triangle_count, (batch + 1) * BATCH_SIZE);
+            uint8_t* contexts = per_vertex ? nullptr : static_cast<uint8_t*>(arenas_[thread_index].allocate(context_stride * (end - batch * BATCH_SIZE)));
+            for (uint32_t t = batch * BATCH_SIZE; t < end; t++) {
+                uint32_t i0 = indices[3 * t];
+                uint32_t i1 = indices[3 * t + 1];
+                uint32_t i2 = indices[3 * t + 2];
+                TriangleSetup setups[MAX_CLIPPED_TRIANGLES];
+                uint32_t setup_count;
+                if (per_vertex) {
+                    setup_count = setupCachedTriangle(i0, i1, i2, setups, statistics);
+                } else {
+                    void* context = contexts + context_stride * (t - batch * BATCH_SIZE);
+                    setup_count = setupTriangle(vertices[i0], vertices[i1], vertices[i2], shader,
+                                                sampler.getValue(i0), sampler.getValue(i1), sampler.getValue(i2), context, setups, statistics);
+                }
+                batch_setups.insert(batch_setups.end(), setups, setups + setup_count);
+            }
+        });
+        for (const DrawStatistics& statistics : thread_statistics_) { statistics_ += statistics; }
+
+        // binning, in submission order so every tile keeps the draw order
+        uint32_t tile_size = tile_size_;
+        if (useHierarchicalDepth()) {
+            // every hierarchical depth block belongs to a single tile
+            tile_size = (tile_size + HIERARCHICAL_DEPTH_BLOCK_SIZE - 1) / HIERARCHICAL_DEPTH_BLOCK_SIZE * HIERARCHICAL_DEPTH_BLOCK_SIZE;
+        }
+        const uint32_t tiles_x = (target_width_ + tile_size - 1) / tile_size;
+        const uint32_t tiles_y = (target_height_ + tile_size - 1) / tile_size;
+        if (deferred_draw != nullptr) {
+            // deferred setups are kept in the arena until the resolve and identified by their index
+            uint32_t setup_count = 0;
+            for (const auto& batch_setups : batch_setups_) { setup_count += static_cast<uint32_t>(batch_setups.size()); }
+            TriangleSetup* setups = arenas_[0].allocateArray<TriangleSetup>(setup_count);
+            deferred_draw->setups = setups;
+            deferred_draw->setup_count = setup_count;
+            for (const auto& batch_setups : batch_setups_) { setups = std::uninitialized_copy(batch_setups.begin(), batch_setups.end(), setups); }
+            if (tileLocalSuperSampling()) return;
+            binSetups(tiles_x, tiles_y, tile_size, [&](auto&& bin_setup) {
+                for (uint32_t i = 0; i < setup_count; i++) { bin_setup(deferred_draw->setups[i]); }
+            });
+            writeBinnedClears(tiles_x, tiles_y, tile_size);
+            const uint32_t draw = static_cast<uint32_t>(deferred_draw - deferred_draws_.data());
+            parallelFor(tiles_x * tiles_y, [&](uint32_t tile, uint32_t) {
+                const int32_t tile_min_x = static_cast<int32_t>((tile % tiles_x) * tile_size);
+                const int32_t tile_min_y = static_cast<int32_t>((tile / tiles_x) * tile_size);
+                const int32_t tile_max_x = tile_min_x + static_cast<int32_t>(tile_size) - 1;
+                const int32_t tile_max_y = tile_min_y + static_cast<int32_t>(tile_size) - 1;
+                const Bin& bin = bins_[tile];
+                for (uint32_t i = 0; i < bin.count; i++) {
+                    const TriangleSetup* setup = bin.setups[i];
+                    const uint32_t triangle = static_cast<uint32_t>(setup - deferred_draw->setups);
+                    rasterizeTriangleVisibility(*setup, draw, triangle, tile_min_x, tile_min_y, tile_max_x, tile_max_y);
+                }
+            });
+            return;
+        }
+        binSetups(tiles_x, tiles_y, tile_size, [&](auto&& bin_setup) {
+            for (const auto& batch_setups : batch_setups_) {
+                for (const TriangleSetup& setup : batch_setups) { bin_setup(setup); }
+            }
+        });
+        writeBinnedClears(tiles_x, tiles_y, tile_size);
 
-        RGBColor result;
-        result.r = static_cast<uint8_t>(src.r * src_alpha + dst.r * inv_alpha);
-        result.g = static_cast<uint8_t>(src.g * src_alpha + dst.g * inv_alpha);
-        result.b = static_cast<uint8_t>(src.b * src_alpha + dst.b * inv_alpha);
-        result.a = static_cast<uint8_t>(std::min(255.0f, src.a + dst.a * inv_alpha));
-        return result;
+        // raster stage, one job per tile
+        parallelFor(tiles_x * tiles_y, [&](uint32_t tile, uint32_t) {
+            const int32_t tile_min_x = static_cast<int32_t>((tile % tiles_x) * tile_size);
+            const int32_t tile_min_y = static_cast<int32_t>((tile / tiles_x) * tile_size);
+            const int32_t tile_max_x = tile_min_x + static_cast<int32_t>(tile_size) - 1;
+            const int32_t tile_max_y = tile_min_y + static_cast<int32_t>(tile_size) - 1;
+            const RenderTarget target{target_framebuffer_ptr_, target_depthbuffer_ptr_, 0, 0};
+            const Bin& bin = bins_[tile];
+            for (uint32_t i = 0; i < bin.count; i++) {
+                rasterizeTriangle(*bin.setups[i], shader, target, tile_min_x, tile_min_y, tile_max_x, tile_max_y);
+            }
+        });
     }
 
-    inline void drawTriangle(const Vector3& v0, const Vector3& v1, const Vector3& v2, Shader& shader, void* data0 = nullptr, void* data1 = nullptr, void* data2 = nullptr) {
+    // fills bins_ from the arena with the setups passed by for_each_setup(bin_setup) to bin_setup, in that order,
+    // the first pass counts the setups of every tile and the second stores them
+    template<typename ForEachSetup>
+    inline void binSetups(uint32_t tiles_x, uint32_t tiles_y, uint32_t tile_size, ForEachSetup&& for_each_setup) {
+        const uint32_t tile_count = tiles_x * tiles_y;
+        bins_ = arenas_[0].allocateArray<Bin>(tile_count);
+        for (uint32_t tile = 0; tile < tile_count; tile++) { bins_[tile] = Bin{nullptr, 0}; }
+        auto for_each_bin = [&](const TriangleSetup& setup, auto&& func) {
+            for (uint32_t ty = setup.bbox_min_y / tile_size; ty <= setup.bbox_max_y / tile_size; ty++) {
+                for (uint32_t tx = setup.bbox_min_x / tile_size; tx <= setup.bbox_max_x / tile_size; tx++) { func(bins_[ty * tiles_x + tx]); }
+            }
+        };
+        std::size_t entry_count = 0;
+        for_each_setup([&](const TriangleSetup& setup) {
+            for_each_bin(setup, [&](Bin& bin) {
+                bin.count++;
+                entry_count++;
+            });
+        });
+        const TriangleSetup** entries = arenas_[0].allocateArray<const TriangleSetup*>(entry_count);
+        for (uint32_t tile = 0; tile < tile_count; tile++) {
+            bins_[tile].setups = entries;
+            entries += bins_[tile].count;
+            bins_[tile].count = 0;
+        }
+        for_each_setup([&](const TriangleSetup& setup) {
+            for_each_bin(setup, [&](Bin& bin) { bin.setups[bin.count++] = &setup; });
+        });
+    }
+
+    // raster stage of tile-local supersampling, bins the pending draws and rasterizes every tile through all of them
+    inline void rasterizeSuperSampleTiles() {
+        const uint32_t ssaa = getSuperSampleFactor();
+        const uint32_t tile_size = getSuperSampleTileSize(ssaa) * ssaa;
+        const uint32_t tiles_x = (target_width_ + tile_size - 1) / tile_size;
+        const uint32_t tiles_y = (target_height_ + tile_size - 1) / tile_size;
+        for (uint32_t i = 0; i < deferred_draw_count_; i++) {
+            DeferredDraw& draw = deferred_draws_[i];
+            binSetups(tiles_x, tiles_y, tile_size, [&draw](auto&& bin_setup) {
+                for (uint32_t k = 0; k < draw.setup_count; k++) { bin_setup(draw.setups[k]); }
+            });
+            draw.bins = bins_;
+        }
+        tile_framebuffers_.resize(thread_count_);
+        tile_depthbuffers_.resize(thread_count_);
+        parallelFor(tiles_x * tiles_y, [&](uint32_t tile, uint32_t thread_index) {
+            rasterizeSuperSampleTile(tile, ssaa, tile_size, static_cast<int32_t>((tile % tiles_x) * tile_size), static_cast<int32_t>((tile / tiles_x) * tile_size),
+                                     thread_index);
+        });
+    }
+
+    /**
+     * @brief Rasterizes a tile of the pending draws of tile-local supersampling.
+     *
+     * Rasterizes the tile of tile_size^2 samples through the draws in
+     * submission order into the scratch buffers of the thread and resolves it
+     * once into framebuffer_ and depthbuffer_, so edges of every draw of the
+     * frame keep all their samples. The samples start out as copies of their
+     * pixel, so pixels the triangles do not touch keep their value.
+     */
+    inline void rasterizeSuperSampleTile(uint32_t tile, uint32_t ssaa, uint32_t tile_size, int32_t tile_min_x, int32_t tile_min_y, uint32_t thread_index) {
+        bool covered = false;
+        for (uint32_t i = 0; i < deferred_draw_count_; i++) { covered = covered || deferred_draws_[i].bins[tile].count > 0; }
+        if (!covered) return;
+        GraphicsBuffer<RGBColor>& tile_framebuffer = tile_framebuffers_[thread_index];
+        GraphicsBuffer<DepthT>& tile_depthbuffer = tile_depthbuffers_[thread_index];
+        if (tile_framebuffer.getWidth() != tile_size) {
+            tile_framebuffer = GraphicsBuffer<RGBColor>(tile_size, tile_size, scratchBufferAllocation());
+            tile_depthbuffer = GraphicsBuffer<DepthT>(tile_size, tile_size, scratchBufferAllocation());
+        }
+        // pixels of the tile, clamped to the framebuffer
+        const uint32_t pixel_min_x = static_cast<uint32_t>(tile_min_x) / ssaa;
+        const uint32_t pixel_min_y = static_cast<uint32_t>(tile_min_y) / ssaa;
+        const uint32_t pixel_max_x = std::min(framebuffer_->getWidth(), pixel_min_x + tile_size / ssaa);
+        const uint32_t pixel_max_y = std::min(framebuffer_->getHeight(), pixel_min_y + tile_size / ssaa);
+        for (uint32_t y = pixel_min_y; y < pixel_max_y; y++) {
+            for (uint32_t x = pixel_min_x; x < pixel_max_x; x++) {
+                const RGBColor color = framebuffer_->getValue(x, y);
+                const DepthT depth = depthbuffer_->getValue(x, y);
+                for (uint32_t j = 0; j < ssaa; j++) {
+                    RGBColor* color_row = tile_framebuffer[(y - pixel_min_y) * ssaa + j] + (x - pixel_min_x) * ssaa;
+                    DepthT* depth_row = tile_depthbuffer[(y - pixel_min_y) * ssaa + j] + (x - pixel_min_x) * ssaa;
+                    std::fill(color_row, color_row + ssaa, color);
+                    std::fill(depth_row, depth_row + ssaa, depth);
+                }
+            }
+        }
+
+        const RenderTarget target{&tile_framebuffer, &tile_depthbuffer, tile_min_x, tile_min_y};
+        const int32_t tile_max_x = tile_min_x + static_cast<int32_t>(tile_size) - 1;
+        const int32_t tile_max_y = tile_min_y + static_cast<int32_t>(tile_size) - 1;
+        for (uint32_t i = 0; i < deferred_draw_count_; i++) {
+            const DeferredDraw& draw = deferred_draws_[i];
+            if (draw.bins[tile].count > 0) { draw.raster(*this, draw.shader, draw.bins[tile], target, tile_min_x, tile_min_y, tile_max_x, tile_max_y); }
+        }
+
+        // draws after a resolve load their samples from the resolved depth, so it is always resolved
+        for (uint32_t y = pixel_min_y; y < pixel_max_y; y++) {
+            resolveSuperSampleRow(tile_framebuffer, tile_depthbuffer, ssaa, pixel_min_x, pixel_min_y, y, pixel_min_x, pixel_max_x, true);
+        }
+    }
+
+    // averages the ssaa x ssaa samples of the pixels [x_begin, x_end) of row y into framebuffer_ and depthbuffer_,
+    // the samples of pixel (x, y) start at ((x - origin_x) * ssaa, (y - origin_y) * ssaa) of the sample buffers
+    inline void resolveSuperSampleRow(const GraphicsBuffer<RGBColor>& colors, const GraphicsBuffer<DepthT>& depths, uint32_t ssaa,
+                                      uint32_t origin_x, uint32_t origin_y, uint32_t y, uint32_t x_begin, uint32_t x_end, bool resolve_depth) const {
+        const RGBColor* color_rows[MAX_SUPER_SAMPLE_FACTOR];
+        const DepthT* depth_rows[MAX_SUPER_SAMPLE_FACTOR];
+        for (uint32_t j = 0; j < ssaa; j++) {
+            color_rows[j] = colors[(y - origin_y) * ssaa + j] + (x_begin - origin_x) * ssaa;
+            depth_rows[j] = depths[(y - origin_y) * ssaa + j] + (x_begin - origin_x) * ssaa;
+        }
+        resolveSamples(color_rows, resolve_depth ? depth_rows : nullptr, ssaa, ssaa, (*framebuffer_)[y] + x_begin, (*depthbuffer_)[y] + x_begin, x_end - x_begin);
+    }
+
+    /**
+     * @brief Resolves pixel_count pixels from their samples.
+     *
+     * Pixel i owns the samples [i * columns, (i + 1) * columns) of each of the
+     * row_count sample rows. Its color is the truncated average of the samples
+     * and its depth the minimum, depth_rows may be nullptr to skip the depth.
+     * At most 256 samples per pixel, so the channel sums fit into 16 bits.
+     */
+    inline void resolveSamples(const RGBColor* const* color_rows, const DepthT* const* depth_rows, uint32_t row_count, uint32_t columns,
+                               RGBColor* colors, DepthT* depths, uint32_t pixel_count) const {
+#ifdef Q3_SSE2
+        if (simd_level_ != SIMD_LEVEL::SCALAR) {
+            resolveSamplesSse2(color_rows, depth_rows, row_count, columns, colors, depths, pixel_count);
+            return;
+        }
+#endif
+        resolveSamplesScalar(color_rows, depth_rows, row_count, columns, colors, depths, pixel_count);
+    }
+
+    static inline void resolveSamplesScalar(const RGBColor* const* color_rows, const DepthT* const* depth_rows, uint32_t row_count, uint32_t columns,
+                                            RGBColor* colors, DepthT* depths, uint32_t pixel_count) {
+        const int32_t sample_count = static_cast<int32_t>(row_count * columns);
+        for (uint32_t x = 0; x < pixel_count; x++) {
+            Vector3i color;
+            int alpha = 0;
+            DepthT min_depth = std::numeric_limits<DepthT>::max();
+            for (uint32_t j = 0; j < row_count; j++) {
+                for (uint32_t i = x * columns; i < (x + 1) * columns; i++) {
+                    const RGBColor& c = color_rows[j][i];
+                    color.x += c.r; color.y += c.g; color.z += c.b;
+                    alpha += c.a;
+                    if (depth_rows != nullptr) { min_depth = std::min(min_depth, depth_rows[j][i]); }
+                }
+            }
+            color /= sample_count;
+            alpha /= sample_count;
+            colors[x] = RGBColor{static_cast<uint8_t>(color.x), static_cast<uint8_t>(color.y), static_cast<uint8_t>(color.z), static_cast<uint8_t>(alpha)};
+            if (depth_rows != nullptr) { depths[x] = min_depth; }
+        }
+    }
+
+#ifdef Q3_SSE2
+    // same results as the scalar version, the sums are exact and the minimum does not depend on the order
+    static inline void resolveSamplesSse2(const RGBColor* const* color_rows, const DepthT* const* depth_rows, uint32_t row_count, uint32_t columns,
+                                          RGBColor* colors, DepthT* depths, uint32_t pixel_count) {
+        static_assert(sizeof(RGBColor) == 4, "RGBColor must be 4 packed bytes");
+        const uint32_t sample_count = row_count * columns;
+        // power of two sample counts divide with a shift
+        const bool power_of_two = (sample_count & (sample_count - 1)) == 0;
+        const int shift = power_of_two ? static_cast<int>(countTrailingZeros(sample_count)) : 0;
+        const __m128i zero = _mm_setzero_si128();
+        for (uint32_t x = 0; x < pixel_count; x++) {
+            const uint32_t begin = x * columns;
+            const uint32_t end = begin + columns;
+            // 16 bit channel sums of two samples, r g b a r g b a
+            __m128i sum = zero;
+            __m128 min_depth = _mm_set1_ps(std::numeric_limits<float>::max());
+            float min_depth_tail = std::numeric_limits<float>::max();
+            for (uint32_t j = 0; j < row_count; j++) {
+                const RGBColor* row = color_rows[j];
+                uint32_t i = begin;
+                for (; i + 4 <= end; i += 4) {
+                    __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+                    sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_unpacklo_epi8(samples, zero), _mm_unpackhi_epi8(samples, zero)));
+                }
+                for (; i + 2 <= end; i += 2) {
+                    __m128i samples = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + i));
+                    sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(samples, zero));
+                }
+                if (i < end) {
+                    int32_t sample;
+                    std::memcpy(&sample, row + i, sizeof(sample));
+                    sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(_mm_cvtsi32_si128(sample), zero));
+                }
+                if (depth_rows == nullptr) continue;
+                const DepthT* depth_row = depth_rows[j];
+                i = begin;
+                for (; i + 4 <= end; i += 4) { min_depth = _mm_min_ps(min_depth, Depth::load4(depth_row + i)); }
+                for (; i < end; i++) { min_depth_tail = std::min(min_depth_tail, static_cast<float>(depth_row[i])); }
+            }
+            sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+            uint8_t bytes[4];
+            if (power_of_two) {
+                sum = _mm_srli_epi16(sum, shift);
+                int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(sum, zero));
+                std::memcpy(bytes, &packed, sizeof(packed));
+            } else {
+                alignas(16) uint16_t channels[8];
+                _mm_store_si128(reinterpret_cast<__m128i*>(channels), sum);
+                for (uint32_t c = 0; c < 4; c++) { bytes[c] = static_cast<uint8_t>(channels[c] / sample_count); }
+            }
+            colors[x] = RGBColor{bytes[0], bytes[1], bytes[2], bytes[3]};
+            if (depth_rows == nullptr) continue;
+            min_depth = _mm_min_ps(min_depth, _mm_movehl_ps(min_depth, min_depth));
+            min_depth = _mm_min_ss(min_depth, _mm_shuffle_ps(min_depth, min_depth, 1));
+            depths[x] = static_cast<DepthT>(std::min(_mm_cvtss_f32(min_depth), min_depth_tail));
+        }
+    }
+#endif
+
+    // runs func(index, thread_index) for every index in [0, count), on the thread pool if there is one
+    template<typename F>
+    inline void parallelFor(uint32_t count, F&& func) {
+        if (thread_pool_ != nullptr) {
+            thread_pool_->parallelFor(count, std::forward<F>(func));
+            return;
+        }
+        for (uint32_t i = 0; i < count; i++) { func(i, 0); }
+    }
+
+    // samples per pixel edge of the SSAA modes, 1 for the other modes
+    inline uint32_t getSuperSampleFactor() const {
+        switch (aa_mode_) {
+        case AA_MODE::SSAA_2X: return 2;
+        case AA_MODE::SSAA_4X: return 4;
+        case AA_MODE::SSAA_8X: return 8;
+        case AA_MODE::SSAA_16X: return 16;
+        default: return 1;
+        }
+    }
+
+    inline bool tileLocalSuperSampling() const { return tile_local_super_sampling_ && getSuperSampleFactor() > 1; }
+
+    // tile edge in pixels of the tile-local supersampling mode, a tile covers about tile_size_ samples
+    // per edge and its sample origin stays aligned to FragmentBlock::SIZE
+    inline uint32_t getSuperSampleTileSize(uint32_t ssaa) const {
+        const uint32_t alignment = std::max(1u, FragmentBlock::SIZE / ssaa);
+        const uint32_t pixels = std::max(1u, tile_size_ / ssaa);
+        return (pixels + alignment - 1) / alignment * alignment;
+    }
+
+    inline bool useHierarchicalDepth() const { return hierarchical_depth_ && !tileLocalSuperSampling(); }
+
+    // true if the triangle lies behind every hierarchical depth block touched by the inclusive rectangle
+    inline bool hierarchicalDepthRejectsTriangle(const TriangleSetup& setup, int32_t min_x, int32_t min_y, int32_t max_x, int32_t max_y) const {
+        if (min_x > max_x || min_y > max_y) return true;
+        const float min_z = Depth::quantize(setup.min_z - HIERARCHICAL_DEPTH_TOLERANCE);
+        constexpr int32_t block_size = static_cast<int32_t>(HIERARCHICAL_DEPTH_BLOCK_SIZE);
+        for (int32_t by = min_y / block_size; by <= max_y / block_size; by++) {
+            const float* row = hierarchical_depthbuffer_[by];
+            for (int32_t bx = min_x / block_size; bx <= max_x / block_size; bx++) {
+                if (!(min_z > row[bx])) return false;
+            }
+        }
+        return true;
+    }
+
+    // true if no fragment of the triangle inside the hierarchical depth block of pixel (x, y) can pass the depth test,
+    // samples may lie up to sample_radius pixels away from the pixel sample point
+    inline bool hierarchicalDepthRejectsBlock(const TriangleSetup& setup, int32_t x, int32_t y, float sample_radius) const {
+        constexpr int32_t block_size = static_cast<int32_t>(HIERARCHICAL_DEPTH_BLOCK_SIZE);
+        const int32_t bx = x / block_size;
+        const int32_t by = y / block_size;
+        // the depth plane is smallest at one corner of the block
+        const float corner_x = static_cast<float>(setup.z_dx < 0.0f ? bx * block_size + block_size - 1 : bx * block_size);
+        const float corner_y = static_cast<float>(setup.z_dy < 0.0f ? by * block_size + block_size - 1 : by * block_size);
+        const float dx = corner_x + (setup.z_dx < 0.0f ? sample_radius : -sample_radius) - setup.v0.x;
+        const float dy = corner_y + (setup.z_dy < 0.0f ? sample_radius : -sample_radius) - setup.v0.y;
+        const float min_z = std::max(setup.min_z, setup.v0.z + setup.z_dx * dx + setup.z_dy * dy);
+        return Depth::quantize(min_z - HIERARCHICAL_DEPTH_TOLERANCE) > hierarchical_depthbuffer_.getValue(bx, by);
+    }
+
+    inline void flushDirtyBlocks(DirtyBlocks& dirty) {
+        if (dirty.max_bx < 0) return;
+        refreshHierarchicalDepth(dirty.min_bx, dirty.max_bx, dirty.by);
+        dirty = DirtyBlocks{};
+    }
+
+    // recomputes the farthest depth of the blocks [min_bx, max_bx] of block row by from the depth buffer of the render target
+    inline void refreshHierarchicalDepth(int32_t min_bx, int32_t max_bx, int32_t by) {
+        const uint32_t samples = msaa_samples_;
+        const uint32_t y_begin = static_cast<uint32_t>(by) * HIERARCHICAL_DEPTH_BLOCK_SIZE;
+        const uint32_t y_end = std::min(target_height_, y_begin + HIERARCHICAL_DEPTH_BLOCK_SIZE);
+        float* blocks = hierarchical_depthbuffer_[static_cast<uint32_t>(by)];
+        for (int32_t bx = min_bx; bx <= max_bx; bx++) {
+            // the samples of a pixel are stored next to each other
+            const uint32_t x_begin = static_cast<uint32_t>(bx) * HIERARCHICAL_DEPTH_BLOCK_SIZE * samples;
+            const uint32_t x_end = std::min(target_width_, static_cast<uint32_t>(bx + 1) * HIERARCHICAL_DEPTH_BLOCK_SIZE) * samples;
+            float max_depth = -std::numeric_limits<float>::infinity();
+#ifdef Q3_SSE2
+            __m128 max_depth4 = _mm_set1_ps(max_depth);
+#endif
+            for (uint32_t y = y_begin; y < y_end; y++) {
+                const DepthT* depth = (*target_depthbuffer_ptr_)[y];
+                uint32_t x = x_begin;
+#ifdef Q3_SSE2
+                for (; x + 4 <= x_end; x += 4) { max_depth4 = _mm_max_ps(max_depth4, Depth::load4(depth + x)); }
+#endif
+                for (; x < x_end; x++) { max_depth = std::max(max_depth, static_cast<float>(depth[x])); }
+            }
+#ifdef Q3_SSE2
+            max_depth4 = _mm_max_ps(max_depth4, _mm_movehl_ps(max_depth4, max_depth4));
+            max_depth4 = _mm_max_ss(max_depth4, _mm_shuffle_ps(max_depth4, max_depth4, 1));
+            max_depth = std::max(max_depth, _mm_cvtss_f32(max_depth4));
+#endif
+            blocks[bx] = max_depth;
+        }
+    }
+
+    template<typename ShaderT>
+    static inline RGBColor shadeDeferred(void* shader, const TriangleSetup& setup, VaryingPlanes& planes, bool new_triangle, const Barycentric& barycentric,
+                                         int32_t x, int32_t y) {
+        auto&& interface = shaderInterface(*static_cast<ShaderT*>(shader));
+        if (new_triangle) { setupVaryingPlanes(setup, interface, planes); }
+        return shadeFragment(setup, interface, planes, barycentric, x, y);
+    }
+    template<typename ShaderT>
+    static inline void rasterizeDeferredBin(RasterizerT& rasterizer, void* shader, const Bin& bin, const RenderTarget& target, int32_t min_x, int32_t min_y,
+                                            int32_t max_x, int32_t max_y) {
+        auto&& interface = shaderInterface(*static_cast<ShaderT*>(shader));
+        for (uint32_t i = 0; i < bin.count; i++) { rasterizer.rasterizeTriangle(*bin.setups[i], interface, target, min_x, min_y, max_x, max_y); }
+    }
+    static inline Shader& shaderInterface(Shader& shader) { return shader; }
+    template<typename ShaderT>
+    static inline StaticShader<ShaderT> shaderInterface(ShaderT& shader) { return StaticShader<ShaderT>(shader); }
+
+    // second pass of the deferred mode, shades the visible pixels of the pending draws
+    inline void shadeVisibilityBuffer() {
+        constexpr uint32_t rows_per_job = 8;
+        const uint32_t height = visibility_buffer_.getHeight();
+        parallelFor((height + rows_per_job - 1) / rows_per_job, [&](uint32_t job, uint32_t) {
+            const uint32_t end = std::min(height, (job + 1) * rows_per_job);
+            // neighbouring pixels mostly show the same triangle, its varying planes are kept until another one is visible
+            VaryingPlanes planes;
+            uint32_t planes_draw = NO_DRAW;
+            uint32_t planes_triangle = 0;
+            for (uint32_t y = job * rows_per_job; y < end; y++) {
+                VisibilitySample* samples = visibility_buffer_[y];
+                for (uint32_t x = 0; x < visibility_buffer_.getWidth(); x++) {
+                    VisibilitySample& sample = samples[x];
+                    if (sample.draw == NO_DRAW) continue;
+                    const DeferredDraw& draw = deferred_draws_[sample.draw];
+                    const TriangleSetup& setup = draw.setups[sample.triangle];
+                    const bool new_triangle = sample.draw != planes_draw || sample.triangle != planes_triangle;
+                    planes_draw = sample.draw;
+                    planes_triangle = sample.triangle;
+                    // leave the buffer empty for the next frame
+                    sample.draw = NO_DRAW;
+                    RGBColor src_color = draw.shade(draw.shader, setup, planes, new_triangle, Barycentric{1.0f - sample.l1 - sample.l2, sample.l1, sample.l2},
+                                                     static_cast<int32_t>(x), static_cast<int32_t>(y));
+                    if (src_color.a == 0) continue;
+                    blendFragment(src_color, target_framebuffer_ptr_->getValue(x, y));
+                }
+            }
+        });
+    }
+
+    template<typename ShaderT>
+    inline bool deferredShading(const ShaderT& shader) const {
+        return deferred_shading_ && shader.isOpaque() && blendReplacesOpaque(blend_mode_) && msaa_samples_ == 1 && !tileLocalSuperSampling();
+    }
+
+    // first pass of the deferred mode, records the draw and rasterizes its visibility,
+    // with tile-local supersampling only records the draw and its setups
+    template<typename ShaderT, typename SamplerT>
+    inline void drawBufferDeferred(const DataBuffer<Vector3>& vertices, const DataBuffer<uint32_t>& indices, ShaderT& shader, SamplerT& sampler,
+                                   void* deferred_shader, DeferredShadeFunc deferred_shade, DeferredRasterFunc deferred_raster) {
+        if (deferred_draw_count_ == NO_DRAW) { throw std::runtime_error("too many deferred draws"); }
+        if (!tileLocalSuperSampling() && (visibility_buffer_.getWidth() != target_width_ || visibility_buffer_.getHeight() != target_height_)) {
+            visibility_buffer_ = GraphicsBuffer<VisibilitySample>(target_width_, target_height_, VisibilitySample{NO_DRAW, 0, 0.0f, 0.0f});
+        }
+        if (deferred_draw_count_ == deferred_draws_.size()) { deferred_draws_.emplace_back(); }
+        DeferredDraw& draw = deferred_draws_[deferred_draw_count_++];
+        draw.shader = deferred_shader;
+        draw.shade = deferred_shade;
+        draw.raster = deferred_raster;
+        drawBufferTiled(vertices, indices, shader, sampler, &draw);
+    }
+
+    // deferred mode of rasterizeTriangle(), writes depth and the visibility buffer of the covered fragments
+    inline void rasterizeTriangleVisibility(const TriangleSetup& setup, uint32_t draw, uint32_t triangle, int32_t min_x, int32_t min_y, int32_t max_x, int32_t max_y) {
+        rasterizeSpans(setup, min_x, min_y, max_x, max_y, [&](int32_t x, int32_t y, const Barycentric& barycentric, float z) {
+            DepthT& depth = target_depthbuffer_ptr_->getValue(x, y);
+            const DepthT value = Depth::encode(z);
+            if (value > depth) return false;
+            depth = value;
+            visibility_buffer_.setValue(x, y, VisibilitySample{draw, triangle, barycentric.l1, barycentric.l2});
+            return true;
+        });
+    }
+
+    // blends src into the framebuffer color dst, opaque fragments of the replacing blend modes never read dst
+    inline void blendFragment(const RGBColor& src, RGBColor& dst) const {
+        if (src.a == 255 && blendReplacesOpaque(blend_mode_)) {
+            dst = src;
+            return;
+        }
+        dst = blendPixel(blend_mode_, src, dst);
+    }
+
+    // context is storage of at least shader.getContextSize() bytes
+    template<typename ShaderT>
+    inline void drawTriangle(const Vector3& v0, const Vector3& v1, const Vector3& v2, ShaderT& shader, void* data0, void* data1, void* data2, void* context) {
+        TriangleSetup setups[MAX_CLIPPED_TRIANGLES];
+        uint32_t setup_count = setupTriangle(v0, v1, v2, shader, data0, data1, data2, context, setups, statistics_);
+        const RenderTarget target{target_framebuffer_ptr_, target_depthbuffer_ptr_, 0, 0};
+        for (uint32_t k = 0; k < setup_count; k++) {
+            writePendingClears(setups[k].bbox_min_x, setups[k].bbox_min_y, setups[k].bbox_max_x, setups[k].bbox_max_y);
+            rasterizeTriangle(setups[k], shader, target, 0, 0, std::numeric_limits<int32_t>::max(), std::numeric_limits<int32_t>::max());
+        }
+    }
+
+    // runs the vertex shader and the clipping stage, returns the number of screen space triangles written to setups
+    template<typename ShaderT>
+    inline uint32_t setupTriangle(const Vector3& v0, const Vector3& v1, const Vector3& v2, ShaderT& shader, void* data0, void* data1, void* data2, void* context, TriangleSetup* setups, DrawStatistics& statistics) const {
         Vertex v0_(v0);
         Vertex v1_(v1);
         Vertex v2_(v2);
-        void* context = alloca(shader.getContextSize());
 
         bool drawable = shader.vertexShader(v0_, v1_, v2_, data0, data1, data2, context);
-        if (!drawable) return;
+        if (!drawable) {
+            statistics.shader_culled++;
+            return 0;
+        }
+        return clipTriangle(v0_, v1_, v2_, data0, data1, data2, context, setups, statistics);
+    }
+
+    // assembles a triangle from the post-transform vertex cache filled by shadeVertices()
+    inline uint32_t setupCachedTriangle(uint32_t i0, uint32_t i1, uint32_t i2, TriangleSetup* setups, DrawStatistics& statistics) {
+        return clipTriangle(vertex_cache_[i0], vertex_cache_[i1], vertex_cache_[i2],
+                            varyingAt(i0), varyingAt(i1), varyingAt(i2), nullptr, setups, statistics);
+    }
+
+    static inline uint32_t computeOutcode(const Vertex& v, float limit) {
+        uint32_t code = 0;
+        float limit_w = limit * v.w;
+        if (v.x < -limit_w) code |= CLIP_LEFT;
+        if (v.x > limit_w) code |= CLIP_RIGHT;
+        if (v.y < -limit_w) code |= CLIP_BOTTOM;
+        if (v.y > limit_w) code |= CLIP_TOP;
+        if (v.z < -v.w) code |= CLIP_NEAR;
+        if (v.z > v.w) code |= CLIP_FAR;
+        return code;
+    }
+
+    // signed distance of a clip space vertex to a clipping plane, positive inside
+    static inline float clipDistance(const Vertex& v, uint32_t plane) {
+        switch (plane) {
+        case CLIP_LEFT: return v.x + GUARD_BAND * v.w;
+        case CLIP_RIGHT: return GUARD_BAND * v.w - v.x;
+        case CLIP_BOTTOM: return v.y + GUARD_BAND * v.w;
+        case CLIP_TOP: return GUARD_BAND * v.w - v.y;
+        case CLIP_NEAR:
+        default: return v.z + v.w;
+        }
+    }
 
+    /**
+     * @brief Cull and clipping stage, works on a triangle in clip space.
+     *
+     * Triangles entirely outside one frustum plane are rejected, then the cull
+     * mode is applied to the winding of the whole triangle. Triangles that
+     * cross the near plane or leave the guard band are clipped against those
+     * planes (Sutherland-Hodgman) and split into a fan of pieces; the far plane
+     * and the screen edges are left to the per-pixel depth test and the
+     * bounding box clamp.
+     *
+     * @return number of screen space triangles written to setups, at most MAX_CLIPPED_TRIANGLES
+     */
+    inline uint32_t clipTriangle(const Vertex& v0, const Vertex& v1, const Vertex& v2, void* data0, void* data1, void* data2, void* context, TriangleSetup* setups, DrawStatistics& statistics) const {
+        uint32_t frustum0 = computeOutcode(v0, 1.0f);
+        uint32_t frustum1 = computeOutcode(v1, 1.0f);
+        uint32_t frustum2 = computeOutcode(v2, 1.0f);
+        if (frustum0 & frustum1 & frustum2) { // trivially outside
+            statistics.frustum_culled++;
+            return 0;
+        }
+
+        if (cull_mode_ != CULL_MODE::NONE) {
+            // homogeneous orientation test, equals w0 * w1 * w2 times the doubled NDC area and stays valid for vertices behind the eye
+            float orientation = v0.x * (v1.y * v2.w - v2.y * v1.w) - v0.y * (v1.x * v2.w - v2.x * v1.w) + v0.w * (v1.x * v2.y - v2.x * v1.y);
+            if ((cull_mode_ == CULL_MODE::BACK && orientation < 0.0f) || (cull_mode_ == CULL_MODE::FRONT && orientation > 0.0f)) {
+                statistics.face_culled++;
+                return 0;
+            }
+        }
+
+        uint32_t planes = (computeOutcode(v0, GUARD_BAND) | computeOutcode(v1, GUARD_BAND) | computeOutcode(v2, GUARD_BAND)) & ~CLIP_FAR;
+        if (planes == 0) {
+            return setupScreenTriangle(v0, v1, v2, nullptr, data0, data1, data2, context, setups[0], statistics) ? 1 : 0;
+        }
+        statistics.clipped++;
+
+        // Sutherland-Hodgman against every plane the triangle crosses
+        ClipVertex polygons[2][MAX_CLIPPED_TRIANGLES + 2];
+        uint32_t count = 3;
+        polygons[0][0] = {v0, {1.0f, 0.0f, 0.0f}};
+        polygons[0][1] = {v1, {0.0f, 1.0f, 0.0f}};
+        polygons[0][2] = {v2, {0.0f, 0.0f, 1.0f}};
+        uint32_t current = 0;
+        for (uint32_t plane = CLIP_LEFT; plane <= CLIP_NEAR; plane <<= 1) {
+            if ((planes & plane) == 0) continue;
+            const ClipVertex* in = polygons[current];
+            ClipVertex* out = polygons[current ^ 1];
+            uint32_t out_count = 0;
+            for (uint32_t i = 0; i < count; i++) {
+                const ClipVertex& a = in[i];
+                const ClipVertex& b = in[(i + 1) % count];
+                float da = clipDistance(a.position, plane);
+                float db = clipDistance(b.position, plane);
+                if (da >= 0.0f) { out[out_count++] = a; }
+                if ((da >= 0.0f) != (db >= 0.0f)) {
+                    float t = da / (da - db);
+                    out[out_count++] = {Vertex(a.position + (b.position - a.position) * t), a.weights + (b.weights - a.weights) * t};
+                }
+            }
+            count = out_count;
+            current ^= 1;
+            if (count < 3) {
+                statistics.frustum_culled++;
+                return 0;
+            }
+        }
+
+        // triangulate the convex polygon as a fan, keeping the winding
+        const ClipVertex* polygon = polygons[current];
+        uint32_t setup_count = 0;
+        for (uint32_t i = 1; i + 1 < count; i++) {
+            const ClipVertex* piece[3] = {&polygon[0], &polygon[i], &polygon[i + 1]};
+            if (piece[0]->position.w <= 0.0f || piece[1]->position.w <= 0.0f || piece[2]->position.w <= 0.0f) continue;
+            Vector3 weights[3] = {piece[0]->weights, piece[1]->weights, piece[2]->weights};
+            if (setupScreenTriangle(piece[0]->position, piece[1]->position, piece[2]->position, weights, data0, data1, data2, context, setups[setup_count], statistics)) {
+                setup_count++;
+            }
+        }
+        return setup_count;
+    }
+
+    // viewport transform and triangle setup of a triangle in clip space, returns false if the triangle is culled
+    // clip_weights are the original barycentrics of the vertices of a clipped piece, nullptr for whole triangles
+    inline bool setupScreenTriangle(Vertex v0_, Vertex v1_, Vertex v2_, const Vector3* clip_weights, void* data0, void* data1, void* data2, void* context, TriangleSetup& setup, DrawStatistics& statistics) const {
         viewportTransform(v0_);
         viewportTransform(v1_);
         viewportTransform(v2_);
+        setup.fixed_point = raster_mode_ == RASTER_MODE::FIXED_POINT && msaa_samples_ == 1;
+        if (setup.fixed_point) {
+            // snap to the sub-pixel grid, the float setup below then describes the same triangle as the integer one
+            for (Vertex* v : {&v0_, &v1_, &v2_}) {
+                v->x = std::round(v->x * SUB_PIXEL_SCALE) / SUB_PIXEL_SCALE;
+                v->y = std::round(v->y * SUB_PIXEL_SCALE) / SUB_PIXEL_SCALE;
+            }
+        }
 
-        Triangle triangle{Vector3(v0_), Vector3(v1_), Vector3(v2_), 1.0f / v0_.w, 1.0f / v1_.w, 1.0f / v2_.w};
+        setup.v0 = v0_;
+        setup.v1 = v1_;
+        setup.v2 = v2_;
+        setup.triangle = Triangle{Vector3(v0_), Vector3(v1_), Vector3(v2_), 1.0f / v0_.w, 1.0f / v1_.w, 1.0f / v2_.w};
+        setup.clipped = clip_weights != nullptr;
+        if (setup.clipped) {
+            setup.clip_weights[0] = clip_weights[0] * setup.triangle.v0_reciprocal_w;
+            setup.clip_weights[1] = clip_weights[1] * setup.triangle.v1_reciprocal_w;
+            setup.clip_weights[2] = clip_weights[2] * setup.triangle.v2_reciprocal_w;
+            // the barycentrics handed to the shader are already perspective-correct
+            setup.triangle.v0_reciprocal_w = 1.0f;
+            setup.triangle.v1_reciprocal_w = 1.0f;
+            setup.triangle.v2_reciprocal_w = 1.0f;
+        }
+        setup.data0 = data0;
+        setup.data1 = data1;
+        setup.data2 = data2;
+        setup.context = context;
+
+        // edge equations, the doubled signed area is shared by all barycentrics
+        float e1_x = v1_.x - v0_.x, e1_y = v1_.y - v0_.y;
+        float e2_x = v2_.x - v0_.x, e2_y = v2_.y - v0_.y;
+        float area2 = e1_x * e2_y - e2_x * e1_y;
+        // degenerate triangle (same threshold as calculateBarycentric)
+        if (zero_area_culling_ ? area2 * area2 < 1e-6f : area2 == 0.0f) {
+            statistics.zero_area_culled++;
+            return false;
+        }
+        float reciprocal_area2 = 1.0f / area2;
+        setup.l1_dx = e2_y * reciprocal_area2;
+        setup.l1_dy = -e2_x * reciprocal_area2;
+        setup.l2_dx = -e1_y * reciprocal_area2;
+        setup.l2_dy = e1_x * reciprocal_area2;
+        setup.z_dx = (v1_.z - v0_.z) * setup.l1_dx + (v2_.z - v0_.z) * setup.l2_dx;
+        setup.z_dy = (v1_.z - v0_.z) * setup.l1_dy + (v2_.z - v0_.z) * setup.l2_dy;
+        setup.min_z = std::min({v0_.z, v1_.z, v2_.z});
+        if (setup.fixed_point && !setupFixedPointEdges(setup)) {
+            statistics.zero_area_culled++;
+            return false;
+        }
 
         int32_t bbox_min_x = std::min({static_cast<int32_t>(v0_.x), static_cast<int32_t>(v1_.x), static_cast<int32_t>(v2_.x)});
         int32_t bbox_min_y = std::min({static_cast<int32_t>(v0_.y), static_cast<int32_t>(v1_.y), static_cast<int32_t>(v2_.y)});
         int32_t bbox_max_x = std::max({static_cast<int32_t>(v0_.x), static_cast<int32_t>(v1_.x), static_cast<int32_t>(v2_.x)});
         int32_t bbox_max_y = std::max({static_cast<int32_t>(v0_.y), static_cast<int32_t>(v1_.y), static_cast<int32_t>(v2_.y)});
-        bbox_min_x = std::max(0, bbox_min_x);
-        bbox_min_y = std::max(0, bbox_min_y);
-        bbox_max_x = std::min(static_cast<int32_t>(target_framebuffer_ptr_->getWidth() - 1), bbox_max_x);
-        bbox_max_y = std::min(static_cast<int32_t>(target_framebuffer_ptr_->getHeight() - 1), bbox_max_y);
+        if (setup.fixed_point) {
+            // exactly the pixels whose center lies inside the bounds of the snapped vertices
+            bbox_min_x = static_cast<int32_t>(std::ceil(std::min({v0_.x, v1_.x, v2_.x}) - 0.5f));
+            bbox_min_y = static_cast<int32_t>(std::ceil(std::min({v0_.y, v1_.y, v2_.y}) - 0.5f));
+            bbox_max_x = static_cast<int32_t>(std::floor(std::max({v0_.x, v1_.x, v2_.x}) - 0.5f));
+            bbox_max_y = static_cast<int32_t>(std::floor(std::max({v0_.y, v1_.y, v2_.y}) - 0.5f));
+            if (bbox_min_x > bbox_max_x || bbox_min_y > bbox_max_y) {
+                statistics.small_culled++;
+                return false;
+            }
+        } else if (msaa_samples_ > 1) {
+            // samples lie up to half a pixel away from the pixel sample point
+            bbox_min_x--;
+            bbox_min_y--;
+            bbox_max_x++;
+            bbox_max_y++;
+        }
+        setup.bbox_min_x = std::max(0, bbox_min_x);
+        setup.bbox_min_y = std::max(0, bbox_min_y);
+        setup.bbox_max_x = std::min(static_cast<int32_t>(target_width_) - 1, bbox_max_x);
+        setup.bbox_max_y = std::min(static_cast<int32_t>(target_height_) - 1, bbox_max_y);
+        if (setup.bbox_min_x > setup.bbox_max_x || setup.bbox_min_y > setup.bbox_max_y) {
+            statistics.frustum_culled++;
+            return false;
+        }
+        if (small_triangle_culling_ && msaa_samples_ == 1 && !setup.fixed_point) {
+            // pixels are sampled at integer coordinates
+            float min_x = std::min({v0_.x, v1_.x, v2_.x});
+            float min_y = std::min({v0_.y, v1_.y, v2_.y});
+            float max_x = std::max({v0_.x, v1_.x, v2_.x});
+            float max_y = std::max({v0_.y, v1_.y, v2_.y});
+            if (std::ceil(min_x) > std::floor(max_x) || std::ceil(min_y) > std::floor(max_y)) {
+                statistics.small_culled++;
+                return false;
+            }
+        }
+        statistics.rasterized++;
+        return true;
+    }
 
+    // integer edge functions of the snapped triangle, returns false if its area is zero
+    static inline bool setupFixedPointEdges(TriangleSetup& setup) {
+        const int64_t x[3] = {static_cast<int64_t>(setup.v0.x * SUB_PIXEL_SCALE), static_cast<int64_t>(setup.v1.x * SUB_PIXEL_SCALE), static_cast<int64_t>(setup.v2.x * SUB_PIXEL_SCALE)};
+        const int64_t y[3] = {static_cast<int64_t>(setup.v0.y * SUB_PIXEL_SCALE), static_cast<int64_t>(setup.v1.y * SUB_PIXEL_SCALE), static_cast<int64_t>(setup.v2.y * SUB_PIXEL_SCALE)};
+        const int64_t area2 = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if (area2 == 0) return false;
+        constexpr int64_t half_pixel = SUB_PIXEL_SCALE / 2;
+        for (uint32_t i = 0; i < 3; i++) {
+            // edge from a to b, opposite to vertex i
+            const uint32_t a = (i + 1) % 3;
+            const uint32_t b = (i + 2) % 3;
+            int64_t edge_x = y[a] - y[b];
+            int64_t edge_y = x[b] - x[a];
+            if (area2 < 0) {
+                edge_x = -edge_x;
+                edge_y = -edge_y;
+            }
+            // the inside lies right of a left edge and below a horizontal top edge (y points down)
+            const bool top_left = edge_x > 0 || (edge_x == 0 && edge_y > 0);
+            setup.edge_c[i] = edge_x * (half_pixel - x[a]) + edge_y * (half_pixel - y[a]) - (top_left ? 0 : 1);
+            setup.edge_dx[i] = edge_x * SUB_PIXEL_SCALE;
+            setup.edge_dy[i] = edge_y * SUB_PIXEL_SCALE;
+        }
+        return true;
+    }
+
+    // rasterizes the part of the triangle inside the inclusive rectangle [min_x, max_x] x [min_y, max_y]
+    template<typename ShaderT>
+    inline void rasterizeTriangle(const TriangleSetup& setup, ShaderT& shader, const RenderTarget& target, int32_t min_x, int32_t min_y, int32_t max_x, int32_t max_y) {
+        if (msaa_samples_ > 1) {
+            rasterizeTriangleMultisample(setup, shader, target, min_x, min_y, max_x, max_y);
+            return;
+        }
+        if (fragment_mode_ == FRAGMENT_MODE::BLOCK) {
+            rasterizeTriangleBlocks(setup, shader, target, min_x, min_y, max_x, max_y);
+            return;
+        }
+        VaryingPlanes planes;
+        setupVaryingPlanes(setup, shader, planes);
+        rasterizeSpans(setup, min_x, min_y, max_x, max_y, [&](int32_t x, int32_t y, const Barycentric& barycentric, float z) {
+            const uint32_t target_x = x - target.origin_x;
+            const uint32_t target_y = y - target.origin_y;
+            const DepthT depth = Depth::encode(z);
+            if (depth > target.depthbuffer->getValue(target_x, target_y)) return false;
+
+            RGBColor src_color = shadeFragment(setup, shader, planes, barycentric, x, y);
+            if (src_color.a == 0) return false;
+            blendFragment(src_color, target.framebuffer->getValue(target_x, target_y));
+
+            if (src_color.a == 255) {
+                target.depthbuffer->setValue(target_x, target_y, depth);
+                return true;
+            }
+            return false;
+        });
+    }
+
+    /**
+     * @brief Walks the covered pixels of the triangle inside the inclusive rectangle [min_x, max_x] x [min_y, max_y].
+     *
+     * Shared by the scalar and the visibility raster paths. Calls
+     * fragment(x, y, barycentric, z) for every covered pixel with a depth in
+     * [0, 1], in row order. fragment does the depth test and returns true if
+     * it wrote depth. Blocks rejected by the hierarchical depth buffer are
+     * skipped.
+     */
+    template<typename FragmentFunc>
+    inline void rasterizeSpans(const TriangleSetup& setup, int32_t min_x, int32_t min_y, int32_t max_x, int32_t max_y, FragmentFunc&& fragment) {
+        const Vertex& v0_ = setup.v0;
+        const Vertex& v1_ = setup.v1;
+        const Vertex& v2_ = setup.v2;
+
+        int32_t bbox_min_x = std::max(min_x, setup.bbox_min_x);
+        int32_t bbox_min_y = std::max(min_y, setup.bbox_min_y);
+        int32_t bbox_max_x = std::min(max_x, setup.bbox_max_x);
+        int32_t bbox_max_y = std::min(max_y, setup.bbox_max_y);
+        const bool hierarchical = useHierarchicalDepth();
+        if (hierarchical && hierarchicalDepthRejectsTriangle(setup, bbox_min_x, bbox_min_y, bbox_max_x, bbox_max_y)) return;
+        DirtyBlocks dirty;
+
+        // the fixed point mode samples pixel centers and tests coverage with the integer edge functions
+        const bool fixed_point = setup.fixed_point;
+        const float sample_offset = fixed_point ? 0.5f : 0.0f;
+        const float origin_x = v0_.x - sample_offset;
+        const float origin_y = v0_.y - sample_offset;
+
+        const float l1_dx = setup.l1_dx, l1_dy = setup.l1_dy;
+        const float l2_dx = setup.l2_dx, l2_dy = setup.l2_dy;
+        bool span_found = false;
         for (int32_t y = bbox_min_y; y <= bbox_max_y; y++) {
-            for (int32_t x = bbox_min_x; x <= bbox_max_x; x++) {
-                Barycentric barycentric = calculateBarycentric(triangle, {static_cast<float>(x), static_cast<float>(y)});
-                if (barycentric.l0 < 0 || barycentric.l1 < 0 || barycentric.l2 < 0) continue;
+            if (hierarchical && y % HIERARCHICAL_DEPTH_BLOCK_SIZE == 0) { flushDirtyBlocks(dirty); }
+            // barycentrics at x = origin_x of this row, l0 = 1 - l1 - l2
+            float dy = static_cast<float>(y) - origin_y;
+            float l1_row = l1_dy * dy;
+            float l2_row = l2_dy * dy;
+            int32_t x_start, x_end;
+            findSpan(setup, l1_row + l1_dx * sample_offset, l2_row + l2_dx * sample_offset, 0.0f, bbox_min_x, bbox_max_x, x_start, x_end);
+            if (x_start > x_end) {
+                // triangles are convex, no row after the covered ones can be covered again
+                if (span_found) break;
+                continue;
+            }
+            span_found = true;
+
+            int64_t edge_row[3] = {0, 0, 0};
+            if (fixed_point) {
+                for (uint32_t i = 0; i < 3; i++) { edge_row[i] = setup.edge_c[i] + setup.edge_dy[i] * y; }
+            }
+            for (int32_t x = x_start; x <= x_end; x++) {
+                if (hierarchical && (x == x_start || x % HIERARCHICAL_DEPTH_BLOCK_SIZE == 0) && hierarchicalDepthRejectsBlock(setup, x, y, sample_offset)) {
+                    // continue at the next block
+                    x |= HIERARCHICAL_DEPTH_BLOCK_SIZE - 1;
+                    continue;
+                }
+                if (fixed_point) {
+                    // the top-left bias is part of edge_c, so a pixel is covered if no edge function is negative
+                    const int64_t e0 = edge_row[0] + setup.edge_dx[0] * x;
+                    const int64_t e1 = edge_row[1] + setup.edge_dx[1] * x;
+                    const int64_t e2 = edge_row[2] + setup.edge_dx[2] * x;
+                    if ((e0 | e1 | e2) < 0) continue;
+                }
+                // evaluated from the row origin rather than accumulated, so the result does not depend on where the span starts
+                float dx = static_cast<float>(x) - origin_x;
+                float l1 = l1_row + l1_dx * dx;
+                float l2 = l2_row + l2_dx * dx;
+                Barycentric barycentric{1.0f - l1 - l2, l1, l2};
+                if (!fixed_point && (barycentric.l0 < 0 || barycentric.l1 < 0 || barycentric.l2 < 0)) continue;
 
                 float z = v0_.z * barycentric.l0 + v1_.z * barycentric.l1 + v2_.z * barycentric.l2;
                 if (z < 0.0f || z > 1.0f) continue;
-                if (z > target_depthbuffer_ptr_->getValue(x, y)) continue;
+                if (fragment(x, y, barycentric, z) && hierarchical) { dirty.mark(x, y); }
+            }
+        }
+        if (hierarchical) { flushDirtyBlocks(dirty); }
+    }
+
+    // finds the pixels [x_start, x_end] of a row that may be covered by the triangle, or sets x_start > x_end if there are none
+    // l1_row and l2_row are the barycentrics at x = v0.x of the row, samples may lie up to sample_radius pixels away from the pixel sample point
+    static inline void findSpan(const TriangleSetup& setup, float l1_row, float l2_row, float sample_radius, int32_t bbox_min_x, int32_t bbox_max_x, int32_t& x_start, int32_t& x_end) {
+        const float v0_x = setup.v0.x;
+        const float l0_row = 1.0f - l1_row - l2_row;
+        const float l0_dx = -(setup.l1_dx + setup.l2_dx);
+        const float l0_dy = -(setup.l1_dy + setup.l2_dy);
+        // solve l_i(x) >= 0 for the covered span, relative to v0.x
+        float span_min = static_cast<float>(bbox_min_x) - v0_x;
+        float span_max = static_cast<float>(bbox_max_x) - v0_x;
+        auto clip_span = [&span_min, &span_max, sample_radius](float l_row, float l_dx, float l_dy) {
+            // the largest value a sample of the pixel can reach
+            if (sample_radius > 0.0f) { l_row += sample_radius * (std::fabs(l_dx) + std::fabs(l_dy)); }
+            // l_row is rounded differently from the per-pixel barycentrics, a row on a horizontal edge (l_dx == 0) is left to the exact test
+            l_row += COVERAGE_TOLERANCE;
+            if (l_dx > 0.0f) { span_min = std::max(span_min, -l_row / l_dx); }
+            else if (l_dx < 0.0f) { span_max = std::min(span_max, -l_row / l_dx); }
+            else if (l_row < 0.0f) { span_max = -std::numeric_limits<float>::infinity(); }
+        };
+        clip_span(l0_row, l0_dx, l0_dy);
+        clip_span(l1_row, setup.l1_dx, setup.l1_dy);
+        clip_span(l2_row, setup.l2_dx, setup.l2_dy);
+        // widen by one pixel, the exact coverage test settles rounding at the edges
+        x_start = bbox_min_x;
+        x_end = bbox_min_x - 1;
+        if (span_min <= span_max + 2.0f) {
+            x_start = std::max(bbox_min_x, static_cast<int32_t>(std::floor(span_min + v0_x)) - 1);
+            x_end = std::min(bbox_max_x, static_cast<int32_t>(std::ceil(span_max + v0_x)) + 1);
+        }
+    }
+
+    // maps the barycentrics of a clipped piece to perspective-correct barycentrics of the original triangle
+    static inline Barycentric unclipBarycentric(const TriangleSetup& setup, const Barycentric& barycentric) {
+        Vector3 l = setup.clip_weights[0] * barycentric.l0 + setup.clip_weights[1] * barycentric.l1 + setup.clip_weights[2] * barycentric.l2;
+        l /= l.x + l.y + l.z;
+        return {l.x, l.y, l.z};
+    }
+
+    // plane equations of the varyings of Shader::interpolatesVaryings() over the screen space barycentrics l1, l2 of a
+    // triangle, pre-multiplied by 1 / w: float k of the varyings is (c[k] + l1 * d1[k] + l2 * d2[k]) / (w_c + l1 * w_d1 + l2 * w_d2)
+    struct VaryingPlanes {
+        uint32_t count; // 0 if the shader does not interpolate varyings
+        float w_c, w_d1, w_d2;
+        float c[FragmentBlock::MAX_VARYINGS];
+        float d1[FragmentBlock::MAX_VARYINGS];
+        float d2[FragmentBlock::MAX_VARYINGS];
+        // derivatives of Shader::needsVaryingDerivatives() for the quad with the top left pixel (quad_x, quad_y)
+        bool derivatives;
+        int32_t quad_x, quad_y;
+        float dx[FragmentBlock::MAX_VARYINGS];
+        float dy[FragmentBlock::MAX_VARYINGS];
+    };
+
+    template<typename ShaderT>
+    static inline void setupVaryingPlanes(const TriangleSetup& setup, const ShaderT& shader, VaryingPlanes& planes) {
+        planes.count = shader.interpolatesVaryings() ? static_cast<uint32_t>(shader.getVaryingSize() / sizeof(float)) : 0;
+        planes.derivatives = planes.count > 0 && shader.needsVaryingDerivatives();
+        // no quad yet, quads start on even pixels
+        planes.quad_x = planes.quad_y = 1;
+        if (planes.count == 0) return;
+        float varyings[3][FragmentBlock::MAX_VARYINGS];
+        std::memcpy(varyings[0], setup.data0, planes.count * sizeof(float));
+        std::memcpy(varyings[1], setup.data1, planes.count * sizeof(float));
+        std::memcpy(varyings[2], setup.data2, planes.count * sizeof(float));
+        // values at the vertices of the rasterized triangle divided by their w, the vertices of a clipped piece
+        // blend the original vertices with the clip weights, which are already divided by w
+        const Vector3 weights[3] = {setup.clipped ? setup.clip_weights[0] : Vector3(setup.triangle.v0_reciprocal_w, 0.0f, 0.0f),
+                                    setup.clipped ? setup.clip_weights[1] : Vector3(0.0f, setup.triangle.v1_reciprocal_w, 0.0f),
+                                    setup.clipped ? setup.clip_weights[2] : Vector3(0.0f, 0.0f, setup.triangle.v2_reciprocal_w)};
+        float values[3][FragmentBlock::MAX_VARYINGS];
+        float reciprocal_w[3];
+        for (uint32_t i = 0; i < 3; i++) {
+            reciprocal_w[i] = weights[i].x + weights[i].y + weights[i].z;
+            for (uint32_t k = 0; k < planes.count; k++) {
+                values[i][k] = varyings[0][k] * weights[i].x + varyings[1][k] * weights[i].y + varyings[2][k] * weights[i].z;
+            }
+        }
+        planes.w_c = reciprocal_w[0];
+        planes.w_d1 = reciprocal_w[1] - reciprocal_w[0];
+        planes.w_d2 = reciprocal_w[2] - reciprocal_w[0];
+        for (uint32_t k = 0; k < planes.count; k++) {
+            planes.c[k] = values[0][k];
+            planes.d1[k] = values[1][k] - values[0][k];
+            planes.d2[k] = values[2][k] - values[0][k];
+        }
+    }
+
+    // d/dx and d/dy of the varyings in the 2x2 pixel quad of pixel (x, y), the differences between its top left pixel and
+    // the pixels right of and below it like the coarse derivatives of GPUs, which may lie outside the triangle
+    static inline void updateQuadDerivatives(const TriangleSetup& setup, VaryingPlanes& planes, int32_t x, int32_t y) {
+        const int32_t quad_x = x & ~1;
+        const int32_t quad_y = y & ~1;
+        if (quad_x == planes.quad_x && quad_y == planes.quad_y) return;
+        planes.quad_x = quad_x;
+        planes.quad_y = quad_y;
+        // barycentrics of the top left pixel, sampled like the raster paths
+        const float sample_offset = setup.fixed_point ? 0.5f : 0.0f;
+        const float dx = static_cast<float>(quad_x) - (setup.v0.x - sample_offset);
+        const float dy = static_cast<float>(quad_y) - (setup.v0.y - sample_offset);
+        const float l1 = setup.l1_dx * dx + setup.l1_dy * dy;
+        const float l2 = setup.l2_dx * dx + setup.l2_dy * dy;
+        const float w = planes.w_c + l1 * planes.w_d1 + l2 * planes.w_d2;
+        const float w_x = setup.l1_dx * planes.w_d1 + setup.l2_dx * planes.w_d2;
+        const float w_y = setup.l1_dy * planes.w_d1 + setup.l2_dy * planes.w_d2;
+        const float reciprocal_w = 1.0f / w;
+        const float reciprocal_w_x = 1.0f / (w + w_x);
+        const float reciprocal_w_y = 1.0f / (w + w_y);
+        for (uint32_t k = 0; k < planes.count; k++) {
+            const float value = planes.c[k] + l1 * planes.d1[k] + l2 * planes.d2[k];
+            const float value_x = value + setup.l1_dx * planes.d1[k] + setup.l2_dx * planes.d2[k];
+            const float value_y = value + setup.l1_dy * planes.d1[k] + setup.l2_dy * planes.d2[k];
+            planes.dx[k] = value_x * reciprocal_w_x - value * reciprocal_w;
+            planes.dy[k] = value_y * reciprocal_w_y - value * reciprocal_w;
+        }
+    }
+
+    // fragment shader call for the screen space barycentrics of pixel (x, y) of the rasterized triangle
+    template<typename ShaderT>
+    static inline RGBColor shadeFragment(const TriangleSetup& setup, ShaderT& shader, VaryingPlanes& planes, const Barycentric& barycentric, int32_t x, int32_t y) {
+        const Barycentric shading_point = setup.clipped ? unclipBarycentric(setup, barycentric) : barycentric;
+        if (planes.count == 0) {
+            return shader.fragmentShader(setup.triangle, shading_point, setup.data0, setup.data1, setup.data2, setup.context);
+        }
+        // one reciprocal for all varyings
+        float varyings[FragmentBlock::MAX_VARYINGS];
+        const float reciprocal_w = 1.0f / (planes.w_c + barycentric.l1 * planes.w_d1 + barycentric.l2 * planes.w_d2);
+        for (uint32_t k = 0; k < planes.count; k++) {
+            varyings[k] = (planes.c[k] + barycentric.l1 * planes.d1[k] + barycentric.l2 * planes.d2[k]) * reciprocal_w;
+        }
+        if (planes.derivatives) {
+            updateQuadDerivatives(setup, planes, x, y);
+            return shader.fragmentShader(setup.triangle, shading_point, varyings, planes.dx, planes.dy, setup.context);
+        }
+        return shader.fragmentShader(setup.triangle, shading_point, varyings, nullptr, nullptr, setup.context);
+    }
+
+    // sample offsets relative to the pixel sample point, standard D3D patterns
+    static inline const Vector2* getSamplePattern(uint32_t samples) {
+        static const Vector2 pattern2[2] = {{4 / 16.0f, 4 / 16.0f}, {-4 / 16.0f, -4 / 16.0f}};
+        static const Vector2 pattern4[4] = {{-2 / 16.0f, -6 / 16.0f}, {6 / 16.0f, -2 / 16.0f}, {-6 / 16.0f, 2 / 16.0f}, {2 / 16.0f, 6 / 16.0f}};
+        static const Vector2 pattern8[8] = {{1 / 16.0f, -3 / 16.0f}, {-1 / 16.0f, 3 / 16.0f}, {5 / 16.0f, 1 / 16.0f}, {-3 / 16.0f, -5 / 16.0f},
+                                            {-5 / 16.0f, 5 / 16.0f}, {-7 / 16.0f, -1 / 16.0f}, {3 / 16.0f, 7 / 16.0f}, {7 / 16.0f, -7 / 16.0f}};
+        switch (samples) {
+        case 2: return pattern2;
+        case 4: return pattern4;
+        default: return pattern8;
+        }
+    }
+
+    /**
+     * @brief MSAA mode of rasterizeTriangle().
+     *
+     * Coverage and depth are tested per sample, the fragment shader runs once
+     * per pixel at the pixel sample point, or at the first covered sample if
+     * the pixel sample point lies outside the triangle. Its color is blended
+     * into every covered sample that passed the depth test. The samples of a
+     * pixel are stored next to each other, pixel (x, y) sample s lives at
+     * (x * samples + s, y) of the target buffers.
+     */
+    template<typename ShaderT>
+    inline void rasterizeTriangleMultisample(const TriangleSetup& setup, ShaderT& shader, const RenderTarget& target, int32_t min_x, int32_t min_y, int32_t max_x, int32_t max_y) {
+        constexpr uint32_t max_samples = 8;
+        const uint32_t samples = msaa_samples_;
+        const Vector2* pattern = getSamplePattern(samples);
+        VaryingPlanes planes;
+        setupVaryingPlanes(setup, shader, planes);
+        const Vertex& v0_ = setup.v0;
+        const float l1_dx = setup.l1_dx, l1_dy = setup.l1_dy;
+        const float l2_dx = setup.l2_dx, l2_dy = setup.l2_dy;
+        // barycentric offsets of the samples from the pixel sample point
+        float sample_l1[max_samples], sample_l2[max_samples];
+        for (uint32_t s = 0; s < samples; s++) {
+            sample_l1[s] = l1_dx * pattern[s].x + l1_dy * pattern[s].y;
+            sample_l2[s] = l2_dx * pattern[s].x + l2_dy * pattern[s].y;
+        }
+
+        int32_t bbox_min_x = std::max(min_x, setup.bbox_min_x);
+        int32_t bbox_min_y = std::max(min_y, setup.bbox_min_y);
+        int32_t bbox_max_x = std::min(max_x, setup.bbox_max_x);
+        int32_t bbox_max_y = std::min(max_y, setup.bbox_max_y);
+        const bool hierarchical = useHierarchicalDepth();
+        if (hierarchical && hierarchicalDepthRejectsTriangle(setup, bbox_min_x, bbox_min_y, bbox_max_x, bbox_max_y)) return;
+        DirtyBlocks dirty;
+
+        bool span_found = false;
+        for (int32_t y = bbox_min_y; y <= bbox_max_y; y++) {
+            if (hierarchical && y % HIERARCHICAL_DEPTH_BLOCK_SIZE == 0) { flushDirtyBlocks(dirty); }
+            float dy = static_cast<float>(y) - v0_.y;
+            float l1_row = l1_dy * dy;
+            float l2_row = l2_dy * dy;
+            int32_t x_start, x_end;
+            findSpan(setup, l1_row, l2_row, 0.5f, bbox_min_x, bbox_max_x, x_start, x_end);
+            if (x_start > x_end) {
+                if (span_found) break;
+                continue;
+            }
+            span_found = true;
 
-                RGBColor src_color = shader.fragmentShader(triangle, barycentric, data0, data1, data2, context);
+            RGBColor* color_row = (*target.framebuffer)[y - target.origin_y];
+            DepthT* depth_row = (*target.depthbuffer)[y - target.origin_y];
+            for (int32_t x = x_start; x <= x_end; x++) {
+                if (hierarchical && (x == x_start || x % HIERARCHICAL_DEPTH_BLOCK_SIZE == 0) && hierarchicalDepthRejectsBlock(setup, x, y, 0.5f)) {
+                    x |= HIERARCHICAL_DEPTH_BLOCK_SIZE - 1;
+                    continue;
+                }
+                float dx = static_cast<float>(x) - v0_.x;
+                float l1 = l1_row + l1_dx * dx;
+                float l2 = l2_row + l2_dx * dx;
+                RGBColor* colors = color_row + static_cast<uint32_t>(x - target.origin_x) * samples;
+                DepthT* depths = depth_row + static_cast<uint32_t>(x - target.origin_x) * samples;
+
+                uint32_t mask = 0;
+                DepthT z[max_samples];
+                Barycentric shading_point{1.0f - l1 - l2, l1, l2};
+                bool center_covered = shading_point.l0 >= 0 && shading_point.l1 >= 0 && shading_point.l2 >= 0;
+                for (uint32_t s = 0; s < samples; s++) {
+                    Barycentric sample{0.0f, l1 + sample_l1[s], l2 + sample_l2[s]};
+                    sample.l0 = 1.0f - sample.l1 - sample.l2;
+                    if (sample.l0 < 0 || sample.l1 < 0 || sample.l2 < 0) continue;
+                    const float sample_z = setup.v0.z * sample.l0 + setup.v1.z * sample.l1 + setup.v2.z * sample.l2;
+                    if (sample_z < 0.0f || sample_z > 1.0f) continue;
+                    z[s] = Depth::encode(sample_z);
+                    if (z[s] > depths[s]) continue;
+                    if (mask == 0 && !center_covered) { shading_point = sample; }
+                    mask |= 1u << s;
+                }
+                if (mask == 0) continue;
+
+                RGBColor src_color = shadeFragment(setup, shader, planes, shading_point, x, y);
                 if (src_color.a == 0) continue;
-                RGBColor dst_color = target_framebuffer_ptr_->getValue(x, y);
-                RGBColor final_color = alphaBlend(src_color, dst_color);
-                target_framebuffer_ptr_->setValue(x, y, final_color);
+                for (; mask != 0; mask &= mask - 1) {
+                    uint32_t s = countTrailingZeros(mask);
+                    blendFragment(src_color, colors[s]);
+                    if (src_color.a == 255) { depths[s] = z[s]; }
+                }
+                if (hierarchical && src_color.a == 255) { dirty.mark(x, y); }
+            }
+        }
+        if (hierarchical) { flushDirtyBlocks(dirty); }
+    }
+
+    // block fragment mode of rasterizeTriangle(), blocks are aligned to multiples of FragmentBlock::SIZE in screen space
+    template<typename ShaderT>
+    inline void rasterizeTriangleBlocks(const TriangleSetup& setup, ShaderT& shader, const RenderTarget& target, int32_t min_x, int32_t min_y, int32_t max_x, int32_t max_y) {
+        constexpr int32_t block_size = static_cast<int32_t>(FragmentBlock::SIZE);
+        const Vertex& v0_ = setup.v0;
+        int32_t bbox_min_x = std::max(min_x, setup.bbox_min_x);
+        int32_t bbox_min_y = std::max(min_y, setup.bbox_min_y);
+        int32_t bbox_max_x = std::min(max_x, setup.bbox_max_x);
+        int32_t bbox_max_y = std::min(max_y, setup.bbox_max_y);
+        if (bbox_min_x > bbox_max_x || bbox_min_y > bbox_max_y) return;
+        static_assert(HIERARCHICAL_DEPTH_BLOCK_SIZE == FragmentBlock::SIZE, "fragment blocks are hierarchical depth blocks");
+        const bool hierarchical = useHierarchicalDepth();
+        if (hierarchical && hierarchicalDepthRejectsTriangle(setup, bbox_min_x, bbox_min_y, bbox_max_x, bbox_max_y)) return;
+
+        // the fixed point mode samples pixel centers and tests coverage with the integer edge functions
+        const float sample_offset = setup.fixed_point ? 0.5f : 0.0f;
+        const float origin_x = v0_.x - sample_offset;
+        const float origin_y = v0_.y - sample_offset;
+
+        VaryingPlanes planes;
+        setupVaryingPlanes(setup, shader, planes);
+        FragmentBlock block;
+        block.varying_count = planes.count;
+        block.varying_derivatives = planes.derivatives;
+        alignas(32) float z[FragmentBlock::LANES];
+        RGBColor colors[FragmentBlock::LANES];
+        const bool replaces_opaque = blendReplacesOpaque(blend_mode_);
+        RGBColor blend_src[FragmentBlock::LANES];
+        RGBColor blend_colors[FragmentBlock::LANES];
+        RGBColor* blend_targets[FragmentBlock::LANES];
+        BlockRow row{0, origin_x, 0.0f, 0.0f, setup.l1_dx, setup.l2_dx, setup.v0.z, setup.v1.z, setup.v2.z, !setup.fixed_point};
+
+        // barycentrics of a pixel, evaluated like the scalar path
+        auto barycentric_at = [&setup, origin_x, origin_y](int32_t x, int32_t y) {
+            float dx = static_cast<float>(x) - origin_x;
+            float dy = static_cast<float>(y) - origin_y;
+            float l1 = setup.l1_dy * dy + setup.l1_dx * dx;
+            float l2 = setup.l2_dy * dy + setup.l2_dx * dx;
+            return Barycentric{1.0f - l1 - l2, l1, l2};
+        };
+
+        bool block_row_found = false;
+        for (int32_t by = bbox_min_y & ~(block_size - 1); by <= bbox_max_y; by += block_size) {
+            const int32_t y_start = std::max(by, bbox_min_y);
+            const int32_t y_end = std::min(by + block_size - 1, bbox_max_y);
+            bool block_row_covered = false;
+            for (int32_t bx = bbox_min_x & ~(block_size - 1); bx <= bbox_max_x; bx += block_size) {
+                const int32_t x_start = std::max(bx, bbox_min_x);
+                const int32_t x_end = std::min(bx + block_size - 1, bbox_max_x);
+                // coarse test, barycentrics are linear so their maxima over the block lie on its corners
+                Barycentric c0 = barycentric_at(x_start, y_start);
+                Barycentric c1 = barycentric_at(x_end, y_start);
+                Barycentric c2 = barycentric_at(x_start, y_end);
+                Barycentric c3 = barycentric_at(x_end, y_end);
+                if (std::max({c0.l0, c1.l0, c2.l0, c3.l0}) < -COVERAGE_TOLERANCE ||
+                    std::max({c0.l1, c1.l1, c2.l1, c3.l1}) < -COVERAGE_TOLERANCE ||
+                    std::max({c0.l2, c1.l2, c2.l2, c3.l2}) < -COVERAGE_TOLERANCE) continue;
+                block_row_covered = true;
+                if (hierarchical && hierarchicalDepthRejectsBlock(setup, bx, by, sample_offset)) continue;
+
+                // fine test, coverage and depth per pixel row
+                const uint32_t lane_mask = ((1u << (x_end - x_start + 1)) - 1) << (x_start - bx);
+                uint64_t mask = 0;
+                row.x = bx;
+                for (int32_t y = y_start; y <= y_end; y++) {
+                    const uint32_t offset = static_cast<uint32_t>(y - by) * FragmentBlock::SIZE;
+                    const uint32_t row_lanes = setup.fixed_point ? fixedPointCoverage(setup, bx, y, lane_mask) : lane_mask;
+                    if (row_lanes == 0) continue;
+                    float dy = static_cast<float>(y) - origin_y;
+                    row.l1_row = setup.l1_dy * dy;
+                    row.l2_row = setup.l2_dy * dy;
+                    // the origin is a multiple of FragmentBlock::SIZE, lanes outside lane_mask are never loaded
+                    const DepthT* depth = (*target.depthbuffer)[y - target.origin_y] + (bx - target.origin_x);
+                    uint32_t row_mask = evaluateBlockRow(row, row_lanes, depth, block.l0 + offset, block.l1 + offset, block.l2 + offset, z + offset);
+                    mask |= static_cast<uint64_t>(row_mask) << offset;
+                }
+                if (mask == 0) continue;
+
+                block.x = bx;
+                block.y = by;
+                block.mask = mask;
+                if (planes.count > 0) {
+                    for (uint64_t lanes = mask; lanes != 0; lanes &= lanes - 1) {
+                        uint32_t lane = countTrailingZeros(lanes);
+                        const float reciprocal_w = 1.0f / (planes.w_c + block.l1[lane] * planes.w_d1 + block.l2[lane] * planes.w_d2);
+                        for (uint32_t k = 0; k < planes.count; k++) {
+                            block.varyings[k][lane] = (planes.c[k] + block.l1[lane] * planes.d1[k] + block.l2[lane] * planes.d2[k]) * reciprocal_w;
+                        }
+                    }
+                }
+                if (planes.derivatives) {
+                    constexpr uint32_t quads_per_row = FragmentBlock::SIZE / 2;
+                    for (uint32_t quad = 0; quad < FragmentBlock::QUADS; quad++) {
+                        const uint32_t quad_i = 2 * (quad % quads_per_row);
+                        const uint32_t quad_j = 2 * (quad / quads_per_row);
+                        const uint64_t quad_lanes = static_cast<uint64_t>(0x3 | (0x3 << FragmentBlock::SIZE)) << (quad_j * FragmentBlock::SIZE + quad_i);
+                        if ((mask & quad_lanes) == 0) continue;
+                        updateQuadDerivatives(setup, planes, bx + static_cast<int32_t>(quad_i), by + static_cast<int32_t>(quad_j));
+                        for (uint32_t k = 0; k < planes.count; k++) {
+                            block.varying_dx[k][quad] = planes.dx[k];
+                            block.varying_dy[k][quad] = planes.dy[k];
+                        }
+                    }
+                }
+                if (setup.clipped) {
+                    for (uint64_t lanes = mask; lanes != 0; lanes &= lanes - 1) {
+                        uint32_t lane = countTrailingZeros(lanes);
+                        Barycentric barycentric = unclipBarycentric(setup, Barycentric{block.l0[lane], block.l1[lane], block.l2[lane]});
+                        block.l0[lane] = barycentric.l0;
+                        block.l1[lane] = barycentric.l1;
+                        block.l2[lane] = barycentric.l2;
+                    }
+                }
+                if (planes.count > 0) {
+                    shader.fragmentShaderBlock(setup.triangle, block, nullptr, nullptr, nullptr, setup.context, colors);
+                } else {
+                    shader.fragmentShaderBlock(setup.triangle, block, setup.data0, setup.data1, setup.data2, setup.context, colors);
+                }
+                // opaque fragments of the replacing blend modes are stored, the others are gathered and blended in one batch
+                uint32_t blend_count = 0;
+                bool depth_written = false;
+                for (; mask != 0; mask &= mask - 1) {
+                    uint32_t lane = countTrailingZeros(mask);
+                    uint32_t x = static_cast<uint32_t>(bx - target.origin_x) + lane % FragmentBlock::SIZE;
+                    uint32_t y = static_cast<uint32_t>(by - target.origin_y) + lane / FragmentBlock::SIZE;
+                    const RGBColor& src_color = colors[lane];
+                    if (src_color.a == 0) continue;
+                    RGBColor& dst_color = target.framebuffer->getValue(x, y);
+                    if (src_color.a == 255 && replaces_opaque) {
+                        dst_color = src_color;
+                    } else {
+                        blend_src[blend_count] = src_color;
+                        blend_colors[blend_count] = dst_color;
+                        blend_targets[blend_count++] = &dst_color;
+                    }
 
-                if (src_color.a == 255) {
-                    target_depthbuffer_ptr_->setValue(x, y, z);
+                    if (src_color.a == 255) {
+                        target.depthbuffer->setValue(x, y, Depth::encode(z[lane]));
+                        depth_written = true;
+                    }
                 }
+                if (blend_count != 0) {
+                    blendPixels(blend_mode_, blend_src, blend_colors, blend_count, simd_level_);
+                    for (uint32_t i = 0; i < blend_count; i++) { *blend_targets[i] = blend_colors[i]; }
+                }
+                if (hierarchical && depth_written) {
+                    const int32_t block = static_cast<int32_t>(bx / block_size);
+                    refreshHierarchicalDepth(block, block, by / block_size);
+                }
+            }
+            // triangles are convex, no block row after the covered ones can be covered again
+            if (block_row_covered) {
+                block_row_found = true;
+            } else if (block_row_found) {
+                break;
             }
         }
     }
 
+    // lanes of lane_mask whose pixel (x + lane, y) is covered in the fixed point mode
+    inline uint32_t fixedPointCoverage(const TriangleSetup& setup, int32_t x, int32_t y, uint32_t lane_mask) const {
+#ifdef Q3_SSE2
+        if (simd_level_ != SIMD_LEVEL::SCALAR) {
+            // two 64 bit edge values per register, a lane is outside if the sign bit of any edge is set
+            __m128i outside[FragmentBlock::SIZE / 2];
+            for (uint32_t pair = 0; pair < FragmentBlock::SIZE / 2; pair++) { outside[pair] = _mm_setzero_si128(); }
+            for (uint32_t i = 0; i < 3; i++) {
+                const int64_t start = setup.edge_c[i] + setup.edge_dy[i] * y + setup.edge_dx[i] * x;
+                __m128i edge = _mm_set_epi64x(start + setup.edge_dx[i], start);
+                const __m128i step = _mm_set1_epi64x(setup.edge_dx[i] * 2);
+                for (uint32_t pair = 0; pair < FragmentBlock::SIZE / 2; pair++) {
+                    outside[pair] = _mm_or_si128(outside[pair], edge);
+                    edge = _mm_add_epi64(edge, step);
+                }
+            }
+            uint32_t outside_mask = 0;
+            for (uint32_t pair = 0; pair < FragmentBlock::SIZE / 2; pair++) {
+                outside_mask |= static_cast<uint32_t>(_mm_movemask_pd(_mm_castsi128_pd(outside[pair]))) << (2 * pair);
+            }
+            return lane_mask & ~outside_mask;
+        }
+#endif
+        uint32_t mask = 0;
+        for (uint32_t i = 0; i < FragmentBlock::SIZE; i++) {
+            if ((lane_mask & (1u << i)) == 0) continue;
+            const int32_t px = x + static_cast<int32_t>(i);
+            const int64_t e0 = setup.edge_c[0] + setup.edge_dy[0] * y + setup.edge_dx[0] * px;
+            const int64_t e1 = setup.edge_c[1] + setup.edge_dy[1] * y + setup.edge_dx[1] * px;
+            const int64_t e2 = setup.edge_c[2] + setup.edge_dy[2] * y + setup.edge_dx[2] * px;
+            if ((e0 | e1 | e2) >= 0) { mask |= 1u << i; }
+        }
+        return mask;
+    }
+
+    // computes barycentrics and depth of the lanes in lane_mask and returns the lanes that are covered and pass the depth test
+    inline uint32_t evaluateBlockRow(const BlockRow& row, uint32_t lane_mask, const DepthT* depth, float* l0, float* l1, float* l2, float* z) const {
+        switch (simd_level_) {
+#ifdef Q3_AVX2
+        case SIMD_LEVEL::AVX2:
+            return evaluateBlockRowAvx2(row, lane_mask, depth, l0, l1, l2, z);
+#endif
+#ifdef Q3_SSE2
+        case SIMD_LEVEL::SSE2:
+            return evaluateBlockRowSse2(row, lane_mask, depth, l0, l1, l2, z);
+#endif
+        default:
+            return evaluateBlockRowScalar(row, lane_mask, depth, l0, l1, l2, z);
+        }
+    }
+
+    // all versions use the operation order of rasterizeSpans(), so they take its per-pixel coverage and depth decision; the block mode
+    // matches the scalar mode only because the coarse tests of both reject below COVERAGE_TOLERANCE instead of at zero
+    static inline uint32_t evaluateBlockRowScalar(const BlockRow& row, uint32_t lane_mask, const DepthT* depth, float* l0, float* l1, float* l2, float* z) {
+        uint32_t mask = 0;
+        for (uint32_t i = 0; i < FragmentBlock::SIZE; i++) {
+            if ((lane_mask & (1u << i)) == 0) continue;
+            float dx = static_cast<float>(row.x + static_cast<int32_t>(i)) - row.v0_x;
+            l1[i] = row.l1_row + row.l1_dx * dx;
+            l2[i] = row.l2_row + row.l2_dx * dx;
+            l0[i] = 1.0f - l1[i] - l2[i];
+            if (row.test_coverage && (l0[i] < 0 || l1[i] < 0 || l2[i] < 0)) continue;
+            z[i] = row.z0 * l0[i] + row.z1 * l1[i] + row.z2 * l2[i];
+            if (z[i] < 0.0f || z[i] > 1.0f) continue;
+            if (Depth::encode(z[i]) > depth[i]) continue;
+            mask |= 1u << i;
+        }
+        return mask;
+    }
+
+#ifdef Q3_SSE2
+    static inline uint32_t evaluateBlockRowSse2(const BlockRow& row, uint32_t lane_mask, const DepthT* depth, float* l0, float* l1, float* l2, float* z) {
+        uint32_t mask = 0;
+        for (uint32_t half = 0; half < FragmentBlock::SIZE; half += 4) {
+            uint32_t half_mask = (lane_mask >> half) & 0xF;
+            if (half_mask == 0) continue;
+            __m128 dx = _mm_sub_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(row.x + static_cast<int32_t>(half)), _mm_setr_epi32(0, 1, 2, 3))), _mm_set1_ps(row.v0_x));
+            __m128 vl1 = _mm_add_ps(_mm_set1_ps(row.l1_row), _mm_mul_ps(_mm_set1_ps(row.l1_dx), dx));
+            __m128 vl2 = _mm_add_ps(_mm_set1_ps(row.l2_row), _mm_mul_ps(_mm_set1_ps(row.l2_dx), dx));
+            __m128 vl0 = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(1.0f), vl1), vl2);
+            __m128 vz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(row.z0), vl0), _mm_mul_ps(_mm_set1_ps(row.z1), vl1)), _mm_mul_ps(_mm_set1_ps(row.z2), vl2));
+            __m128 vdepth;
+            if (half_mask == 0xF) {
+                vdepth = Depth::load4(depth + half);
+            } else {
+                alignas(16) float partial[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                for (uint32_t i = 0; i < 4; i++) {
+                    if (half_mask & (1u << i)) { partial[i] = static_cast<float>(depth[half + i]); }
+                }
+                vdepth = _mm_load_ps(partial);
+            }
+            __m128 zero = _mm_setzero_ps();
+            // negated compares keep NaN lanes like the scalar "reject if less than" tests
+            __m128 pass = _mm_and_ps(_mm_cmpnlt_ps(vz, zero), _mm_cmpngt_ps(vz, _mm_set1_ps(1.0f)));
+            if (row.test_coverage) { pass = _mm_and_ps(pass, _mm_and_ps(_mm_and_ps(_mm_cmpnlt_ps(vl0, zero), _mm_cmpnlt_ps(vl1, zero)), _mm_cmpnlt_ps(vl2, zero))); }
+            pass = _mm_and_ps(pass, _mm_cmpngt_ps(Depth::quantize4(vz), vdepth));
+            _mm_storeu_ps(l0 + half, vl0);
+            _mm_storeu_ps(l1 + half, vl1);
+            _mm_storeu_ps(l2 + half, vl2);
+            _mm_storeu_ps(z + half, vz);
+            mask |= (static_cast<uint32_t>(_mm_movemask_ps(pass)) & half_mask) << half;
+        }
+        return mask;
+    }
+#endif
+
+#ifdef Q3_AVX2
+    Q3_TARGET_AVX2 static inline uint32_t evaluateBlockRowAvx2(const BlockRow& row, uint32_t lane_mask, const DepthT* depth, float* l0, float* l1, float* l2, float* z) {
+        static_assert(FragmentBlock::SIZE == 8, "the AVX2 path evaluates one block row per register");
+        __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256 dx = _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(row.x), lanes)), _mm256_set1_ps(row.v0_x));
+        __m256 vl1 = _mm256_add_ps(_mm256_set1_ps(row.l1_row), _mm256_mul_ps(_mm256_set1_ps(row.l1_dx), dx));
+        __m256 vl2 = _mm256_add_ps(_mm256_set1_ps(row.l2_row), _mm256_mul_ps(_mm256_set1_ps(row.l2_dx), dx));
+        __m256 vl0 = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), vl1), vl2);
+        __m256 vz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(row.z0), vl0), _mm256_mul_ps(_mm256_set1_ps(row.z1), vl1)), _mm256_mul_ps(_mm256_set1_ps(row.z2), vl2));
+        __m256 vdepth;
+        if (lane_mask == 0xFF) {
+            vdepth = Depth::load8(depth);
+        } else if (sizeof(DepthT) == 4) {
+            __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+            __m256i load_mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(static_cast<int32_t>(lane_mask)), bits), bits);
+            __m256i values = _mm256_maskload_epi32(reinterpret_cast<const int*>(depth), load_mask);
+            vdepth = std::is_same<DepthT, float>::value ? _mm256_castsi256_ps(values) : _mm256_cvtepi32_ps(values);
+        } else {
+            alignas(32) float partial[8] = {};
+            for (uint32_t i = 0; i < 8; i++) {
+                if (lane_mask & (1u << i)) { partial[i] = static_cast<float>(depth[i]); }
+            }
+            vdepth = _mm256_load_ps(partial);
+        }
+        __m256 zero = _mm256_setzero_ps();
+        // negated compares keep NaN lanes like the scalar "reject if less than" tests
+        __m256 pass = _mm256_and_ps(_mm256_cmp_ps(vz, zero, _CMP_NLT_UQ), _mm256_cmp_ps(vz, _mm256_set1_ps(1.0f), _CMP_NGT_UQ));
+        if (row.test_coverage) {
+            pass = _mm256_and_ps(pass, _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(vl0, zero, _CMP_NLT_UQ), _mm256_cmp_ps(vl1, zero, _CMP_NLT_UQ)), _mm256_cmp_ps(vl2, zero, _CMP_NLT_UQ)));
+        }
+        pass = _mm256_and_ps(pass, _mm256_cmp_ps(Depth::quantize8(vz), vdepth, _CMP_NGT_UQ));
+        _mm256_storeu_ps(l0, vl0);
+        _mm256_storeu_ps(l1, vl1);
+        _mm256_storeu_ps(l2, vl2);
+        _mm256_storeu_ps(z, vz);
+        return static_cast<uint32_t>(_mm256_movemask_ps(pass)) & lane_mask;
+    }
+#endif
+
+    // per-vertex stage: shades every index referenced by the draw exactly once into the post-transform vertex cache
+    template<typename ShaderT, typename SamplerT>
+    inline void shadeVertices(const DataBuffer<Vector3>& vertices, const DataBuffer<uint32_t>& indices, ShaderT& shader, SamplerT& sampler) {
+        const uint32_t vertex_count = static_cast<uint32_t>(vertices.size());
+        varying_stride_ = shader.getVaryingSize() == 0 ? 0 : alignedStorageSize(shader.getVaryingSize());
+        vertex_cache_ = arenas_[0].allocateArray<Vertex>(vertex_count);
+        varying_storage_ = static_cast<uint8_t*>(arenas_[0].allocate(varying_stride_ * vertex_count));
+        uint8_t* vertex_referenced = arenas_[0].allocateArray<uint8_t>(vertex_count);
+        std::fill(vertex_referenced, vertex_referenced + vertex_count, 0);
+        for (uint32_t index : indices) { vertex_referenced[index] = 1; }
+
+        auto shade = [&](uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; i++) {
+                if (!vertex_referenced[i]) continue;
+                Vertex v(vertices[i]);
+                shader.perVertexShader(v, sampler.getValue(i), varyingAt(i));
+                new (&vertex_cache_[i]) Vertex(v);
+            }
+        };
+        if (thread_pool_ != nullptr) {
+            const uint32_t batch_count = (vertex_count + BATCH_SIZE - 1) / BATCH_SIZE;
+            thread_pool_->parallelFor(batch_count, [&](uint32_t batch, uint32_t) {
+                shade(batch * BATCH_SIZE, std::min(vertex_count, (batch + 1) * BATCH_SIZE));
+            });
+        } else {
+            shade(0, vertex_count);
+        }
+    }
+
+    inline void* varyingAt(uint32_t index) {
+        if (varying_stride_ == 0) return nullptr;
+        return varying_storage_ + varying_stride_ * index;
+    }
+
+    // size rounded up so consecutive objects keep the fundamental alignment
+    static inline std::size_t alignedStorageSize(std::size_t size) {
+        constexpr std::size_t align = alignof(std::max_align_t);
+        return (size + align - 1) / align * align;
+    }
+
     inline void viewportTransform(Vertex& v) const {
-        float width = static_cast<float>(target_framebuffer_ptr_->getWidth());
-        float height = static_cast<float>(target_framebuffer_ptr_->getHeight());
+        float width = static_cast<float>(target_width_);
+        float height = static_cast<float>(target_height_);
 
         // perspective division
         v.x /= v.w;
@@ -150,19 +2096,69 @@ private:
         v.z = (v.z + 1.0f) * 0.5f;
     }
 
+    // sample and scratch buffers are cleared or written before they are read, so they skip the initialization
+    inline BufferAllocation scratchBufferAllocation() const {
+        BufferAllocation allocation;
+        allocation.initialize = false;
+        allocation.pad_rows = true;
+        allocation.huge_pages = true;
+        allocation.pool = buffer_pool_;
+        return allocation;
+    }
+
     inline void updateSuperSampleBuffers() {
-        auto update_buffer = [this](uint32_t ssaa) {
+        const GraphicsBuffer<RGBColor>* previous_target = target_framebuffer_ptr_;
+        bool reallocated = false;
+        msaa_samples_ = 1;
+        target_width_ = framebuffer_->getWidth();
+        target_height_ = framebuffer_->getHeight();
+        auto update_msaa_buffer = [this, &reallocated](uint32_t samples) {
+            // release the buffers of the other modes first, so the pool can hand their memory to the new ones
+            super_sample_framebuffer_ = nullptr;
+            super_sample_depthbuffer_ = nullptr;
+            // samples of a pixel are stored next to each other in a buffer samples times wider
+            bool need_update = multi_sample_framebuffer_ == nullptr;
+            if (!need_update) { need_update = multi_sample_framebuffer_->getWidth() != framebuffer_->getWidth() * samples || multi_sample_framebuffer_->getHeight() != framebuffer_->getHeight(); }
+            if (need_update) {
+                multi_sample_framebuffer_ = nullptr;
+                multi_sample_depthbuffer_ = nullptr;
+                reallocated = true;
+                multi_sample_framebuffer_ = std::make_shared<GraphicsBuffer<RGBColor>>(framebuffer_->getWidth() * samples, framebuffer_->getHeight(), scratchBufferAllocation());
+                multi_sample_depthbuffer_ = std::make_shared<GraphicsBuffer<DepthT>>(framebuffer_->getWidth() * samples, framebuffer_->getHeight(), scratchBufferAllocation());
+            }
+            target_framebuffer_ptr_ = multi_sample_framebuffer_.get();
+            target_depthbuffer_ptr_ = multi_sample_depthbuffer_.get();
+            msaa_samples_ = samples;
+        };
+        auto update_buffer = [this, &reallocated](uint32_t ssaa) {
+            multi_sample_framebuffer_ = nullptr;
+            multi_sample_depthbuffer_ = nullptr;
+            if (tile_local_super_sampling_) {
+                // samples only live in the per-thread tile buffers, resolveVisibilityBuffer() writes straight into the framebuffer
+                target_framebuffer_ptr_ = framebuffer_.get();
+                target_depthbuffer_ptr_ = depthbuffer_.get();
+                target_width_ = framebuffer_->getWidth() * ssaa;
+                target_height_ = framebuffer_->getHeight() * ssaa;
+                super_sample_framebuffer_ = nullptr;
+                super_sample_depthbuffer_ = nullptr;
+                return;
+            }
             // check buffer already exists
             bool need_update = super_sample_framebuffer_ == nullptr;
             // check buffer size is correct
             if (!need_update) { need_update = super_sample_framebuffer_->getWidth() != framebuffer_->getWidth() * ssaa || super_sample_framebuffer_->getHeight() != framebuffer_->getHeight() * ssaa; }
             // update buffer
             if (need_update) {
-                super_sample_framebuffer_ = std::make_shared<GraphicsBuffer<RGBColor>>(framebuffer_->getWidth() * ssaa, framebuffer_->getHeight() * ssaa);
-                super_sample_depthbuffer_ = std::make_shared<GraphicsBuffer<float>>(framebuffer_->getWidth() * ssaa, framebuffer_->getHeight() * ssaa);
+                super_sample_framebuffer_ = nullptr;
+                super_sample_depthbuffer_ = nullptr;
+                reallocated = true;
+                super_sample_framebuffer_ = std::make_shared<GraphicsBuffer<RGBColor>>(framebuffer_->getWidth() * ssaa, framebuffer_->getHeight() * ssaa, scratchBufferAllocation());
+                super_sample_depthbuffer_ = std::make_shared<GraphicsBuffer<DepthT>>(framebuffer_->getWidth() * ssaa, framebuffer_->getHeight() * ssaa, scratchBufferAllocation());
             }
             target_framebuffer_ptr_ = super_sample_framebuffer_.get();
             target_depthbuffer_ptr_ = super_sample_depthbuffer_.get();
+            target_width_ = super_sample_framebuffer_->getWidth();
+            target_height_ = super_sample_framebuffer_->getHeight();
         };
         switch (aa_mode_) {
         case AA_MODE::SSAA_2X:
@@ -177,73 +2173,231 @@ private:
         case AA_MODE::SSAA_16X:
             update_buffer(16);
             break;
+        case AA_MODE::MSAA_2X:
+            update_msaa_buffer(2);
+            break;
+        case AA_MODE::MSAA_4X:
+            update_msaa_buffer(4);
+            break;
+        case AA_MODE::MSAA_8X:
+            update_msaa_buffer(8);
+            break;
         case AA_MODE::NONE:
         default:
             target_framebuffer_ptr_ = framebuffer_.get();
             target_depthbuffer_ptr_ = depthbuffer_.get();
-            // release super sample buffers
+            // release super sample and multisample buffers
             super_sample_framebuffer_ = nullptr;
             super_sample_depthbuffer_ = nullptr;
+            multi_sample_framebuffer_ = nullptr;
+            multi_sample_depthbuffer_ = nullptr;
             break;
         }
+        if (!tileLocalSuperSampling()) {
+            tile_framebuffers_.clear();
+            tile_depthbuffers_.clear();
+        }
+        // new sample buffers are undefined, kept ones keep their pending clears
+        if (reallocated || target_framebuffer_ptr_ != previous_target) { resetClearTiles(); }
+        // the render target changed
+        updateHierarchicalDepth();
+    }
+
+    // the user only reads framebuffer_ and depthbuffer_, so clears of the sample buffers can wait until a tile is drawn or resolved
+    inline bool lazyClears() const { return aa_mode_ != AA_MODE::NONE && !tileLocalSuperSampling(); }
+
+    // drops the pending clears and sizes the clear tiles to the render target
+    inline void resetClearTiles() {
+        clear_tiles_x_ = (target_width_ + CLEAR_TILE_SIZE - 1) / CLEAR_TILE_SIZE;
+        clear_tiles_y_ = (target_height_ + CLEAR_TILE_SIZE - 1) / CLEAR_TILE_SIZE;
+        clear_tiles_.assign(lazyClears() ? clear_tiles_x_ * clear_tiles_y_ : 0, 0);
+        pending_clear_tiles_ = 0;
     }
 
+    inline void flagClearTiles(uint8_t clears) {
+        for (uint8_t& tile : clear_tiles_) { tile |= clears; }
+        pending_clear_tiles_ = static_cast<uint32_t>(clear_tiles_.size());
+    }
+
+    // fills a clear tile of the sample buffers with its pending clear values
+    inline void writeClearTile(uint32_t tile) {
+        const uint8_t clears = clear_tiles_[tile];
+        const uint32_t samples = msaa_samples_;
+        const uint32_t x_begin = (tile % clear_tiles_x_) * CLEAR_TILE_SIZE;
+        const uint32_t y_begin = (tile / clear_tiles_x_) * CLEAR_TILE_SIZE;
+        const uint32_t x_end = std::min(target_width_, x_begin + CLEAR_TILE_SIZE);
+        const uint32_t y_end = std::min(target_height_, y_begin + CLEAR_TILE_SIZE);
+        for (uint32_t y = y_begin; y < y_end; y++) {
+            if (clears & CLEAR_COLOR) {
+                RGBColor* colors = (*target_framebuffer_ptr_)[y];
+                std::fill(colors + x_begin * samples, colors + x_end * samples, clear_color_);
+            }
+            if (clears & CLEAR_DEPTH) {
+                DepthT* depths = (*target_depthbuffer_ptr_)[y];
+                std::fill(depths + x_begin * samples, depths + x_end * samples, clear_depth_);
+            }
+        }
+        clear_tiles_[tile] = 0;
+    }
+
+    // writes the pending clears of the clear tiles overlapping the inclusive rectangle of render target pixels
+    inline void writePendingClears(int32_t min_x, int32_t min_y, int32_t max_x, int32_t max_y) {
+        if (pending_clear_tiles_ == 0) return;
+        for (uint32_t ty = static_cast<uint32_t>(min_y) / CLEAR_TILE_SIZE; ty <= static_cast<uint32_t>(max_y) / CLEAR_TILE_SIZE; ty++) {
+            for (uint32_t tx = static_cast<uint32_t>(min_x) / CLEAR_TILE_SIZE; tx <= static_cast<uint32_t>(max_x) / CLEAR_TILE_SIZE; tx++) {
+                const uint32_t tile = ty * clear_tiles_x_ + tx;
+                if (clear_tiles_[tile] == 0) continue;
+                writeClearTile(tile);
+                pending_clear_tiles_--;
+            }
+        }
+    }
+
+    // writes the pending clears under every non-empty bin before the raster stage, the tiles of the clears are
+    // independent of the raster tiles, so they are collected first and written in parallel
+    inline void writeBinnedClears(uint32_t tiles_x, uint32_t tiles_y, uint32_t tile_size) {
+        if (pending_clear_tiles_ == 0) return;
+        clear_queue_.clear();
+        for (uint32_t tile = 0; tile < tiles_x * tiles_y; tile++) {
+            if (bins_[tile].count == 0) continue;
+            const uint32_t min_x = (tile % tiles_x) * tile_size;
+            const uint32_t min_y = (tile / tiles_x) * tile_size;
+            const uint32_t max_x = std::min(target_width_, min_x + tile_size) - 1;
+            const uint32_t max_y = std::min(target_height_, min_y + tile_size) - 1;
+            for (uint32_t ty = min_y / CLEAR_TILE_SIZE; ty <= max_y / CLEAR_TILE_SIZE; ty++) {
+                for (uint32_t tx = min_x / CLEAR_TILE_SIZE; tx <= max_x / CLEAR_TILE_SIZE; tx++) {
+                    uint8_t& clears = clear_tiles_[ty * clear_tiles_x_ + tx];
+                    if (clears == 0 || (clears & CLEAR_QUEUED)) continue;
+                    clears |= CLEAR_QUEUED;
+                    clear_queue_.push_back(ty * clear_tiles_x_ + tx);
+                }
+            }
+        }
+        parallelFor(static_cast<uint32_t>(clear_queue_.size()), [&](uint32_t i, uint32_t) { writeClearTile(clear_queue_[i]); });
+        pending_clear_tiles_ -= static_cast<uint32_t>(clear_queue_.size());
+    }
+
+    // resolves the sample buffers into framebuffer_ and depthbuffer_, rows are resolved in parallel on the thread pool
     inline void downSample() {
-        if (aa_mode_ == AA_MODE::NONE) return;
-        auto down_sample = [this](uint32_t ssaa) {
-            uint32_t ssaa2f = ssaa * ssaa;
-            for (uint32_t y = 0; y < framebuffer_->getHeight(); y++) {
-                for (uint32_t x = 0; x < framebuffer_->getWidth(); x++) {
-                    Vector3i color;
-                    int alpha = 0;
-                    float min_depth = std::numeric_limits<float>::max();
-                    for (uint32_t j = 0; j < ssaa; j++) {
-                        for (uint32_t i = 0; i < ssaa; i++) {
-                            const RGBColor& c = super_sample_framebuffer_->getValue(x * ssaa + i, y * ssaa + j);
-                            color.x += c.r; color.y += c.g; color.z += c.b;
-                            alpha += c.a;
-                            float depth = super_sample_depthbuffer_->getValue(x * ssaa + i, y * ssaa + j);
-                            min_depth = std::min(min_depth, depth);
-                        }
+        // tile-local supersampling resolves every tile right after rasterizing it
+        if (aa_mode_ == AA_MODE::NONE || tileLocalSuperSampling()) return;
+        constexpr uint32_t rows_per_job = 8;
+        const uint32_t height = framebuffer_->getHeight();
+        const uint32_t width = framebuffer_->getWidth();
+        const uint32_t ssaa = getSuperSampleFactor();
+        if (pending_clear_tiles_ != 0) {
+            // tiles with both clears pending resolve to the clear values, write the tiles with only one of them
+            clear_queue_.clear();
+            for (uint32_t tile = 0; tile < clear_tiles_.size(); tile++) {
+                if (clear_tiles_[tile] == CLEAR_COLOR || clear_tiles_[tile] == CLEAR_DEPTH) { clear_queue_.push_back(tile); }
+            }
+            parallelFor(static_cast<uint32_t>(clear_queue_.size()), [&](uint32_t i, uint32_t) { writeClearTile(clear_queue_[i]); });
+            pending_clear_tiles_ -= static_cast<uint32_t>(clear_queue_.size());
+        }
+        auto resolve = [&](uint32_t y, uint32_t x_begin, uint32_t x_end) {
+            if (msaa_samples_ > 1) {
+                // the samples of a pixel are next to each other in a single row
+                const RGBColor* color_row = (*multi_sample_framebuffer_)[y] + x_begin * msaa_samples_;
+                const DepthT* depth_row = (*multi_sample_depthbuffer_)[y] + x_begin * msaa_samples_;
+                resolveSamples(&color_row, resolve_depth_ ? &depth_row : nullptr, 1, msaa_samples_, (*framebuffer_)[y] + x_begin, (*depthbuffer_)[y] + x_begin, x_end - x_begin);
+            } else if (ssaa > 1) {
+                resolveSuperSampleRow(*super_sample_framebuffer_, *super_sample_depthbuffer_, ssaa, 0, 0, y, x_begin, x_end, resolve_depth_);
+            }
+        };
+        // pixels per clear tile edge, the samples of a pixel never straddle two tiles
+        const uint32_t tile_pixels = CLEAR_TILE_SIZE / ssaa;
+        parallelFor((height + rows_per_job - 1) / rows_per_job, [&](uint32_t job, uint32_t) {
+            const uint32_t end = std::min(height, (job + 1) * rows_per_job);
+            for (uint32_t y = job * rows_per_job; y < end; y++) {
+                if (pending_clear_tiles_ == 0) {
+                    resolve(y, 0, width);
+                    continue;
+                }
+                // the averages and minimums of identical samples are the clear values themselves
+                const uint8_t* clears = clear_tiles_.data() + (y * ssaa / CLEAR_TILE_SIZE) * clear_tiles_x_;
+                for (uint32_t x = 0; x < width;) {
+                    uint32_t tile = x / tile_pixels;
+                    const bool cleared = clears[tile] != 0;
+                    // run of tiles that are all cleared or all drawn
+                    while (tile + 1 < clear_tiles_x_ && (clears[tile + 1] != 0) == cleared) { tile++; }
+                    const uint32_t x_end = std::min(width, (tile + 1) * tile_pixels);
+                    if (!cleared) {
+                        resolve(y, x, x_end);
+                    } else {
+                        std::fill((*framebuffer_)[y] + x, (*framebuffer_)[y] + x_end, clear_color_);
+                        if (resolve_depth_) { std::fill((*depthbuffer_)[y] + x, (*depthbuffer_)[y] + x_end, clear_depth_); }
                     }
-                    color /= ssaa2f;
-                    alpha /= ssaa2f;
-                    framebuffer_->setValue(x, y, RGBColor{static_cast<uint8_t>(color.x), static_cast<uint8_t>(color.y), static_cast<uint8_t>(color.z), static_cast<uint8_t>(alpha)});
-                    depthbuffer_->setValue(x, y, min_depth);
+                    x = x_end;
                 }
             }
-        };
-        switch (aa_mode_) {
-        case AA_MODE::SSAA_2X:
-            down_sample(2);
-            break;
-        case AA_MODE::SSAA_4X:
-            down_sample(4);
-            break;
-        case AA_MODE::SSAA_8X:
-            down_sample(8);
-            break;
-        case AA_MODE::SSAA_16X:
-            down_sample(16);
-            break;
-        case AA_MODE::NONE:
-        default:
-            break;
-        }
+        });
     }
 
 private:
+    std::shared_ptr<BufferPool> buffer_pool_;
     // frame buffers
     std::shared_ptr<GraphicsBuffer<RGBColor>> framebuffer_;
-    std::shared_ptr<GraphicsBuffer<float>> depthbuffer_;
+    std::shared_ptr<GraphicsBuffer<DepthT>> depthbuffer_;
     // for super sampling
     std::shared_ptr<GraphicsBuffer<RGBColor>> super_sample_framebuffer_;
-    std::shared_ptr<GraphicsBuffer<float>> super_sample_depthbuffer_;
+    std::shared_ptr<GraphicsBuffer<DepthT>> super_sample_depthbuffer_;
+    // for multisampling
+    std::shared_ptr<GraphicsBuffer<RGBColor>> multi_sample_framebuffer_;
+    std::shared_ptr<GraphicsBuffer<DepthT>> multi_sample_depthbuffer_;
     // target buffers
     GraphicsBuffer<RGBColor>* target_framebuffer_ptr_;
-    GraphicsBuffer<float>* target_depthbuffer_ptr_;
+    GraphicsBuffer<DepthT>* target_depthbuffer_ptr_;
+    // size of the rasterized image in pixels, the target buffers are msaa_samples_ times wider
+    uint32_t target_width_;
+    uint32_t target_height_;
+    uint32_t msaa_samples_;
     // draw options
     AA_MODE aa_mode_;
+    RASTER_MODE raster_mode_;
+    FRAGMENT_MODE fragment_mode_;
+    SIMD_LEVEL simd_level_;
+    CULL_MODE cull_mode_;
+    BLEND_MODE blend_mode_;
+    bool zero_area_culling_;
+    bool small_triangle_culling_;
+    DrawStatistics statistics_;
+    // threaded pipeline
+    uint32_t thread_count_;
+    uint32_t tile_size_;
+    bool tile_local_super_sampling_;
+    bool resolve_depth_;
+    std::unique_ptr<ThreadPool> thread_pool_;
+    // one arena per thread for the contexts, the vertex cache and the bins, see resetArenas()
+    std::vector<LinearArena> arenas_;
+    // per-draw storage of the threaded pipeline, kept to avoid reallocations
+    std::vector<std::vector<TriangleSetup>> batch_setups_;
+    Bin* bins_;
+    std::vector<DrawStatistics> thread_statistics_;
+    // farthest stored depth per HIERARCHICAL_DEPTH_BLOCK_SIZE^2 pixel block of the render target, as float
+    bool hierarchical_depth_;
+    GraphicsBuffer<float> hierarchical_depthbuffer_;
+    // deferred mode
+    bool deferred_shading_;
+    GraphicsBuffer<VisibilitySample> visibility_buffer_;
+    std::vector<DeferredDraw> deferred_draws_;
+    uint32_t deferred_draw_count_;
+    // per-thread sample buffers of the tile-local supersampling mode
+    std::vector<GraphicsBuffer<RGBColor>> tile_framebuffers_;
+    std::vector<GraphicsBuffer<DepthT>> tile_depthbuffers_;
+    // post-transform vertex cache of the per-vertex stage, in the arena
+    Vertex* vertex_cache_;
+    uint8_t* varying_storage_;
+    std::size_t varying_stride_;
+    // lazy clears, the pending clears of every CLEAR_TILE_SIZE^2 pixel tile of the render target
+    std::vector<uint8_t> clear_tiles_;
+    uint32_t clear_tiles_x_;
+    uint32_t clear_tiles_y_;
+    uint32_t pending_clear_tiles_;
+    RGBColor clear_color_;
+    DepthT clear_depth_;
+    std::vector<uint32_t> clear_queue_;
 };
 
+using Rasterizer = RasterizerT<float>;
+
 }
@@ -2,11 +2,53 @@
 
 #include "RGBColor.hpp"
 #include "Math.hpp"
+#include "Simd.hpp"
 
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 namespace q3 {
 
+/**
+ * @brief A block of FragmentBlock::SIZE x FragmentBlock::SIZE pixels handed to Shader::fragmentShaderBlock().
+ *
+ * Lane (j * SIZE + i) holds the pixel (x + i, y + j). Only the lanes set in
+ * mask are covered by the triangle and passed the depth test, the barycentrics
+ * and varyings of the other lanes are unspecified. The lane belongs to the
+ * 2x2 pixel quad (j / 2) * (SIZE / 2) + i / 2, whose varying derivatives are
+ * set if any of its lanes is masked.
+ */
+struct FragmentBlock {
+    static constexpr uint32_t SIZE = 8;
+    static constexpr uint32_t LANES = SIZE * SIZE;
+    // largest number of floats of the varyings interpolated by the rasterizer, see Shader::interpolatesVaryings()
+    static constexpr uint32_t MAX_VARYINGS = 16;
+    static constexpr uint32_t QUADS = LANES / 4;
+
+    int32_t x, y;
+    uint64_t mask;
+    // barycentrics in SoA layout
+    alignas(32) float l0[LANES];
+    alignas(32) float l1[LANES];
+    alignas(32) float l2[LANES];
+    // interpolated varyings in SoA layout, float k of lane i is varyings[k][i], 0 floats if the shader does not interpolate varyings
+    uint32_t varying_count;
+    alignas(32) float varyings[MAX_VARYINGS][LANES];
+    // d/dx and d/dy of the varyings per quad, only set if the shader needs them, see Shader::needsVaryingDerivatives()
+    bool varying_derivatives;
+    alignas(32) float varying_dx[MAX_VARYINGS][QUADS];
+    alignas(32) float varying_dy[MAX_VARYINGS][QUADS];
+};
+
+// quad of a lane of FragmentBlock
+inline uint32_t blockQuad(uint32_t lane) {
+    return (lane / FragmentBlock::SIZE / 2) * (FragmentBlock::SIZE / 2) + (lane % FragmentBlock::SIZE) / 2;
+}
+
 class Shader {
 public:
     template<typename T>
@@ -21,7 +63,200 @@ public:
 public:
     virtual std::size_t getContextSize() const = 0;
     virtual bool vertexShader(Vertex& v0, Vertex& v1, Vertex& v2, void* data0, void* data1, void* data2, void* context) = 0;
+    // optional per-vertex stage: when hasPerVertexShader() returns true, drawBuffer() runs perVertexShader() once per
+    // unique index instead of vertexShader() once per triangle and caches the clip space vertices and varyings. The
+    // fragment shader then receives the varyings of the three vertices as data0, data1 and data2 and a null context.
+    virtual bool hasPerVertexShader() const { return false; }
+    virtual std::size_t getVaryingSize() const { return 0; }
+    virtual void perVertexShader(Vertex& /*v*/, void* /*data*/, void* /*varying*/) {}
+    // optional interpolation of the per-vertex varyings: when interpolatesVaryings() returns true, the varyings are
+    // getVaryingSize() / sizeof(float) floats, at most FragmentBlock::MAX_VARYINGS. The rasterizer sets up their plane
+    // equations pre-multiplied by 1 / w once per triangle and interpolates all of them perspective-correctly with one
+    // reciprocal per pixel. fragmentShader() then receives the interpolated floats as data0 and null data1 and data2,
+    // fragmentShaderBlock() receives them in FragmentBlock::varyings and null data0, data1 and data2.
+    virtual bool interpolatesVaryings() const { return false; }
+    // optional screen space derivatives of the interpolated varyings, e.g. for the mip level of a texture: when
+    // needsVaryingDerivatives() returns true, which requires interpolatesVaryings(), fragmentShader() also receives
+    // d/dx and d/dy of the interpolated floats as data1 and data2. Like the coarse derivatives of GPUs they are the
+    // differences between the top left pixel of the 2x2 pixel quad and its neighbours, shared by the whole quad.
+    virtual bool needsVaryingDerivatives() const { return false; }
+    // draws of shaders that may return alpha below 255 keep the forward path in the deferred mode of the rasterizer
+    virtual bool isOpaque() const { return true; }
+    // for pieces of triangles cut by the clipping stage the barycentrics are already perspective-correct and the
+    // reciprocal w of triangle are 1, so perspectiveCorrectInterpolate() gives the same results for whole and clipped triangles
     virtual RGBColor fragmentShader(const Triangle& triangle, const Barycentric& barycentric, void* data0, void* data1, void* data2, const void* context) = 0;
+    // batched entry point used by the block fragment mode, writes the colors of the masked lanes
+    // the default implementation calls fragmentShader() once per masked lane
+    virtual void fragmentShaderBlock(const Triangle& triangle, const FragmentBlock& block, void* data0, void* data1, void* data2, const void* context, RGBColor* colors) {
+        float varyings[FragmentBlock::MAX_VARYINGS];
+        float dx[FragmentBlock::MAX_VARYINGS];
+        float dy[FragmentBlock::MAX_VARYINGS];
+        for (uint64_t mask = block.mask; mask != 0; mask &= mask - 1) {
+            uint32_t lane = countTrailingZeros(mask);
+            if (block.varying_count > 0) {
+                for (uint32_t k = 0; k < block.varying_count; k++) { varyings[k] = block.varyings[k][lane]; }
+                data0 = varyings;
+            }
+            if (block.varying_derivatives) {
+                const uint32_t quad = blockQuad(lane);
+                for (uint32_t k = 0; k < block.varying_count; k++) {
+                    dx[k] = block.varying_dx[k][quad];
+                    dy[k] = block.varying_dy[k][quad];
+                }
+                data1 = dx;
+                data2 = dy;
+            }
+            colors[lane] = fragmentShader(triangle, Barycentric{block.l0[lane], block.l1[lane], block.l2[lane]}, data0, data1, data2, context);
+        }
+    }
+};
+
+// the Context and Varying types of a static shader, void if it does not declare them
+template<typename ShaderT, typename = void>
+struct StaticShaderContext { using type = void; };
+template<typename ShaderT>
+struct StaticShaderContext<ShaderT, std::void_t<typename ShaderT::Context>> { using type = typename ShaderT::Context; };
+
+template<typename ShaderT, typename = void>
+struct StaticShaderVarying { using type = void; };
+template<typename ShaderT>
+struct StaticShaderVarying<ShaderT, std::void_t<typename ShaderT::Varying>> { using type = typename ShaderT::Varying; };
+
+// true if the static shader declares a Varying and a fragment shader taking one interpolated Varying
+template<typename ShaderT, typename = void>
+struct StaticShaderInterpolates : std::false_type {};
+template<typename ShaderT>
+struct StaticShaderInterpolates<ShaderT, std::void_t<decltype(std::declval<ShaderT&>().fragmentShader(
+    std::declval<const Triangle&>(), std::declval<const Barycentric&>(), std::declval<const typename ShaderT::Varying&>()))>> : std::true_type {};
+
+// d/dx and d/dy of the interpolated Varying of a static shader, see Shader::needsVaryingDerivatives()
+template<typename Varying>
+struct VaryingDerivatives {
+    Varying dx, dy;
+};
+
+// true if the static shader declares a fragment shader taking the interpolated Varying and its VaryingDerivatives
+template<typename ShaderT, typename = void>
+struct StaticShaderDerivatives : std::false_type {};
+template<typename ShaderT>
+struct StaticShaderDerivatives<ShaderT, std::void_t<decltype(std::declval<ShaderT&>().fragmentShader(
+    std::declval<const Triangle&>(), std::declval<const Barycentric&>(), std::declval<const typename ShaderT::Varying&>(),
+    std::declval<const VaryingDerivatives<typename ShaderT::Varying>&>()))>> : std::true_type {};
+
+// isOpaque() of a static shader, true if it does not declare one like the default of Shader::isOpaque()
+template<typename ShaderT, typename = void>
+struct StaticShaderOpaque {
+    static bool get(const ShaderT&) { return true; }
+};
+template<typename ShaderT>
+struct StaticShaderOpaque<ShaderT, std::void_t<decltype(std::declval<const ShaderT&>().isOpaque())>> {
+    static bool get(const ShaderT& shader) { return shader.isOpaque(); }
+};
+
+/**
+ * @brief Presents a shader type resolved at compile time with the calls of Shader, without virtual dispatch.
+ *
+ * RasterizerT::drawBuffer<ShaderT>() instantiates the pipeline for this
+ * adapter, so every call below is direct and inlined into the raster loops.
+ * The void pointers of the Shader calls are the pipeline's internal storage,
+ * the adapter casts them back to the typed Attributes, Context and Varying
+ * of ShaderT, which are placement-constructed in that storage and therefore
+ * must be trivially destructible. A Varying that is interpolated by the
+ * rasterizer, and its derivatives, are copied from and to arrays of floats.
+ */
+template<typename ShaderT>
+class StaticShader {
+public:
+    using Attributes = typename ShaderT::Attributes;
+    using Context = typename StaticShaderContext<ShaderT>::type;
+    using Varying = typename StaticShaderVarying<ShaderT>::type;
+    static constexpr bool PER_VERTEX = !std::is_void<Varying>::value;
+    static constexpr bool DERIVATIVES = StaticShaderDerivatives<ShaderT>::value;
+    static constexpr bool INTERPOLATED = StaticShaderInterpolates<ShaderT>::value || DERIVATIVES;
+
+    static_assert(PER_VERTEX == std::is_void<Context>::value, "a static shader declares either a Context or a Varying type");
+    static_assert(std::is_void<Context>::value || std::is_trivially_destructible<Context>::value, "Context must be trivially destructible");
+    static_assert(std::is_void<Varying>::value || std::is_trivially_destructible<Varying>::value, "Varying must be trivially destructible");
+
+    explicit StaticShader(ShaderT& shader) : shader_(shader) {}
+
+    std::size_t getContextSize() const {
+        if constexpr (PER_VERTEX) { return 0; } else { return sizeof(Context); }
+    }
+    bool hasPerVertexShader() const { return PER_VERTEX; }
+    std::size_t getVaryingSize() const {
+        if constexpr (PER_VERTEX) { return sizeof(Varying); } else { return 0; }
+    }
+    bool interpolatesVaryings() const { return INTERPOLATED; }
+    bool needsVaryingDerivatives() const { return DERIVATIVES; }
+    bool isOpaque() const { return StaticShaderOpaque<ShaderT>::get(shader_); }
+
+    inline bool vertexShader(Vertex& v0, Vertex& v1, Vertex& v2, void* data0, void* data1, void* data2, void* context) {
+        if constexpr (PER_VERTEX) {
+            return true;
+        } else {
+            static_assert(alignof(Context) <= alignof(std::max_align_t), "Context must not be over-aligned");
+            return shader_.vertexShader(v0, v1, v2, attributes(data0), attributes(data1), attributes(data2), *new (context) Context);
+        }
+    }
+
+    inline void perVertexShader(Vertex& v, void* data, void* varying) {
+        if constexpr (PER_VERTEX) {
+            static_assert(alignof(Varying) <= alignof(std::max_align_t), "Varying must not be over-aligned");
+            shader_.vertexShader(v, attributes(data), *new (varying) Varying);
+        }
+    }
+
+    inline RGBColor fragmentShader(const Triangle& triangle, const Barycentric& barycentric, void* data0, void* data1, void* data2, const void* context) {
+        if constexpr (INTERPOLATED) {
+            static_assert(std::is_trivially_copyable<Varying>::value, "an interpolated Varying must be trivially copyable");
+            static_assert(sizeof(Varying) % sizeof(float) == 0 && sizeof(Varying) <= FragmentBlock::MAX_VARYINGS * sizeof(float),
+                          "an interpolated Varying must consist of at most FragmentBlock::MAX_VARYINGS floats");
+            Varying varying;
+            std::memcpy(&varying, data0, sizeof(Varying));
+            if constexpr (DERIVATIVES) {
+                VaryingDerivatives<Varying> derivatives;
+                std::memcpy(&derivatives.dx, data1, sizeof(Varying));
+                std::memcpy(&derivatives.dy, data2, sizeof(Varying));
+                return shader_.fragmentShader(triangle, barycentric, static_cast<const Varying&>(varying),
+                                              static_cast<const VaryingDerivatives<Varying>&>(derivatives));
+            } else {
+                return shader_.fragmentShader(triangle, barycentric, static_cast<const Varying&>(varying));
+            }
+        } else if constexpr (PER_VERTEX) {
+            return shader_.fragmentShader(triangle, barycentric, *static_cast<const Varying*>(data0), *static_cast<const Varying*>(data1), *static_cast<const Varying*>(data2));
+        } else {
+            return shader_.fragmentShader(triangle, barycentric, *static_cast<const Context*>(context));
+        }
+    }
+
+    inline void fragmentShaderBlock(const Triangle& triangle, const FragmentBlock& block, void* data0, void* data1, void* data2, const void* context, RGBColor* colors) {
+        float varyings[FragmentBlock::MAX_VARYINGS];
+        float dx[FragmentBlock::MAX_VARYINGS];
+        float dy[FragmentBlock::MAX_VARYINGS];
+        for (uint64_t mask = block.mask; mask != 0; mask &= mask - 1) {
+            uint32_t lane = countTrailingZeros(mask);
+            if constexpr (INTERPOLATED) {
+                for (uint32_t k = 0; k < sizeof(Varying) / sizeof(float); k++) { varyings[k] = block.varyings[k][lane]; }
+                data0 = varyings;
+            }
+            if constexpr (DERIVATIVES) {
+                const uint32_t quad = blockQuad(lane);
+                for (uint32_t k = 0; k < sizeof(Varying) / sizeof(float); k++) {
+                    dx[k] = block.varying_dx[k][quad];
+                    dy[k] = block.varying_dy[k][quad];
+                }
+                data1 = dx;
+                data2 = dy;
+            }
+            colors[lane] = fragmentShader(triangle, Barycentric{block.l0[lane], block.l1[lane], block.l2[lane]}, data0, data1, data2, context);
+        }
+    }
+
+private:
+    static inline const Attributes& attributes(void* data) { return *static_cast<const Attributes*>(data); }
+
+    ShaderT& shader_;
 };
 
 }
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define Q3_SSE2 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// functions using AVX2 intrinsics are compiled for AVX2 and only called after runtime detection
+#if defined(Q3_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define Q3_AVX2 1
+#define Q3_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(Q3_SSE2) && defined(_MSC_VER)
+#define Q3_AVX2 1
+#define Q3_TARGET_AVX2
+#endif
+
+namespace q3 {
+
+enum class SIMD_LEVEL {
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+// highest instruction set supported by both the compiler and the running CPU
+inline SIMD_LEVEL detectSimdLevel() {
+#if defined(Q3_AVX2) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] >= 7) {
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        __cpuidex(info, 7, 0);
+        bool avx2 = (info[1] & (1 << 5)) != 0;
+        // the OS must save the ymm registers
+        if (osxsave && avx && avx2 && (_xgetbv(0) & 0x6) == 0x6) return SIMD_LEVEL::AVX2;
+    }
+    return SIMD_LEVEL::SSE2;
+#elif defined(Q3_AVX2)
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2 ? SIMD_LEVEL::AVX2 : SIMD_LEVEL::SSE2;
+#elif defined(Q3_SSE2)
+    return SIMD_LEVEL::SSE2;
+#else
+    return SIMD_LEVEL::SCALAR;
+#endif
+}
+
+// index of the lowest set bit, value must not be 0
+inline uint32_t countTrailingZeros(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<uint32_t>(__builtin_ctzll(value));
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return static_cast<uint32_t>(index);
+#else
+    uint32_t count = 0;
+    while ((value & 1) == 0) { value >>= 1; count++; }
+    return count;
+#endif
+}
+
+}
@@ -4,28 +4,150 @@
 #include "Buffer.hpp"
 #include "Math.hpp"
 
+#include <algorithm>
 #include <cstdint>
 #include <cmath>
 #include <memory>
+#include <vector>
 
 namespace q3 {
 
-class Texture {
+// the filters below work on any image with getWidth(), getHeight() and getValue(x, y), rows are stored from v = 1 down
+
+inline uint8_t lerpChannel(uint8_t a, uint8_t b, float t) { return static_cast<uint8_t>(a + (b - a) * t + 0.5f); }
+
+inline int32_t wrapTexel(int32_t i, int32_t size) {
+    i %= size;
+    return i < 0 ? i + size : i;
+}
+
+// the texel of image containing uv, same addressing as TextureT::sample()
+template<typename Image>
+inline RGBColor sampleNearest(const Image& image, float u, float v) {
+    const int32_t width = static_cast<int32_t>(image.getWidth());
+    const int32_t height = static_cast<int32_t>(image.getHeight());
+    u -= std::floor(u);
+    v -= std::floor(v);
+    const int32_t x = std::min(static_cast<int32_t>(u * width), width - 1);
+    const int32_t y = std::min(static_cast<int32_t>(v * height), height - 1);
+    return image.getValue(x, height - y - 1);
+}
+
+// weights the 4 texels around uv by its distance to their centers, wrapping at the edges
+template<typename Image>
+inline RGBColor sampleBilinear(const Image& image, float u, float v) {
+    const int32_t width = static_cast<int32_t>(image.getWidth());
+    const int32_t height = static_cast<int32_t>(image.getHeight());
+    u -= std::floor(u);
+    v -= std::floor(v);
+    // texel space with the centers on integers
+    const float x = u * width - 0.5f;
+    const float y = (1.0f - v) * height - 0.5f;
+    const float x_floor = std::floor(x);
+    const float y_floor = std::floor(y);
+    const float tx = x - x_floor;
+    const float ty = y - y_floor;
+    const int32_t x0 = wrapTexel(static_cast<int32_t>(x_floor), width);
+    const int32_t y0 = wrapTexel(static_cast<int32_t>(y_floor), height);
+    const int32_t x1 = x0 + 1 == width ? 0 : x0 + 1;
+    const int32_t y1 = y0 + 1 == height ? 0 : y0 + 1;
+    const RGBColor c00 = image.getValue(x0, y0);
+    const RGBColor c10 = image.getValue(x1, y0);
+    const RGBColor c01 = image.getValue(x0, y1);
+    const RGBColor c11 = image.getValue(x1, y1);
+    const float w00 = (1.0f - tx) * (1.0f - ty), w10 = tx * (1.0f - ty);
+    const float w01 = (1.0f - tx) * ty, w11 = tx * ty;
+    auto blend = [&](uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+        return static_cast<uint8_t>(a * w00 + b * w10 + c * w01 + d * w11 + 0.5f);
+    };
+    return RGBColor{blend(c00.r, c10.r, c01.r, c11.r), blend(c00.g, c10.g, c01.g, c11.g),
+                    blend(c00.b, c10.b, c01.b, c11.b), blend(c00.a, c10.a, c01.a, c11.a)};
+}
+
+// mip level of the screen space derivatives of uv for a level 0 of width x height texels, negative when magnified
+inline float mipLevel(uint32_t width, uint32_t height, const Vector2& ddx, const Vector2& ddy) {
+    const float dx = ddx.x * static_cast<float>(width), dy = ddx.y * static_cast<float>(height);
+    const float du = ddy.x * static_cast<float>(width), dv = ddy.y * static_cast<float>(height);
+    const float rho2 = std::max(dx * dx + dy * dy, du * du + dv * dv);
+    // log2(sqrt(rho2)), the tiny minimum keeps log2 finite for constant uv
+    return 0.5f * std::log2(std::max(rho2, 1e-12f));
+}
+
+// Layout is the memory layout of the image, TiledLayout and MortonLayout keep the texels of a 2D neighbourhood close
+template<typename Layout = LinearLayout>
+class TextureT {
 public:
-    Texture() : imagebuffer_(nullptr), imagebuffer_ptr_(nullptr) {}
-    Texture(std::shared_ptr<GraphicsBuffer<RGBColor>> imagebuffer) : imagebuffer_(imagebuffer), imagebuffer_ptr_(imagebuffer.get()) {}
+    using ImageBuffer = GraphicsBuffer<RGBColor, Layout>;
 
-    void setImageBuffer(std::shared_ptr<GraphicsBuffer<RGBColor>> imagebuffer) {
+    enum class FILTER {
+        NEAREST,  // nearest texel of the nearest mip level, the default
+        BILINEAR, // 2x2 texels of the nearest mip level
+        TRILINEAR // 2x2 texels of the two nearest mip levels, blended by the fractional level
+    };
+
+    TextureT() : imagebuffer_(nullptr), imagebuffer_ptr_(nullptr), filter_(FILTER::NEAREST) {}
+    TextureT(std::shared_ptr<ImageBuffer> imagebuffer) : imagebuffer_(imagebuffer), imagebuffer_ptr_(imagebuffer.get()), filter_(FILTER::NEAREST) {}
+
+    void setImageBuffer(std::shared_ptr<ImageBuffer> imagebuffer) {
         imagebuffer_ = imagebuffer;
         imagebuffer_ptr_ = imagebuffer.get();
+        mip_levels_.clear();
     }
 
-    std::shared_ptr<GraphicsBuffer<RGBColor>> getImageBuffer() const { return imagebuffer_; }
+    std::shared_ptr<ImageBuffer> getImageBuffer() const { return imagebuffer_; }
+
+    void setFilter(FILTER filter) { filter_ = filter; }
+    FILTER getFilter() const { return filter_; }
 
+    /**
+     * @brief Builds the mip chain of the image down to 1x1 texel.
+     *
+     * Every level halves the size of the previous one (rounded down, at
+     * least 1) and averages its 2x2 texels, the last row or column of an odd
+     * sized level is dropped. Call it again after the image changed, the
+     * levels are not updated automatically. Not thread-safe with sampling.
+     */
+    inline void generateMipmaps() {
+        mip_levels_.clear();
+        // every texel is written below
+        BufferAllocation allocation;
+        allocation.initialize = false;
+        const ImageBuffer* source = imagebuffer_ptr_;
+        while (source->getWidth() > 1 || source->getHeight() > 1) {
+            const uint32_t width = std::max(1u, source->getWidth() / 2);
+            const uint32_t height = std::max(1u, source->getHeight() / 2);
+            auto level = std::make_shared<ImageBuffer>(width, height, allocation);
+            const uint32_t max_x = source->getWidth() - 1;
+            const uint32_t max_y = source->getHeight() - 1;
+            for (uint32_t y = 0; y < height; y++) {
+                for (uint32_t x = 0; x < width; x++) {
+                    const RGBColor& c00 = source->getValue(2 * x, 2 * y);
+                    const RGBColor& c10 = source->getValue(std::min(2 * x + 1, max_x), 2 * y);
+                    const RGBColor& c01 = source->getValue(2 * x, std::min(2 * y + 1, max_y));
+                    const RGBColor& c11 = source->getValue(std::min(2 * x + 1, max_x), std::min(2 * y + 1, max_y));
+                    level->setValue(x, y, RGBColor{static_cast<uint8_t>((c00.r + c10.r + c01.r + c11.r + 2) / 4),
+                                                   static_cast<uint8_t>((c00.g + c10.g + c01.g + c11.g + 2) / 4),
+                                                   static_cast<uint8_t>((c00.b + c10.b + c01.b + c11.b + 2) / 4),
+                                                   static_cast<uint8_t>((c00.a + c10.a + c01.a + c11.a + 2) / 4)});
+                }
+            }
+            mip_levels_.push_back(level);
+            source = level.get();
+        }
+    }
+
+    // number of mip levels including the image itself, 1 without generateMipmaps()
+    uint32_t getLevelCount() const { return static_cast<uint32_t>(mip_levels_.size()) + 1; }
+
+    // level 0 is the image itself
+    std::shared_ptr<ImageBuffer> getLevel(uint32_t level) const { return level == 0 ? imagebuffer_ : mip_levels_.at(level - 1); }
+
+    // samples mip level 0 with the filter, the nearest filter keeps the single texel lookup
     inline RGBColor sample(const Vector2& uv) const {
         return sample(uv.x, uv.y);
     }
     inline RGBColor sample(float u, float v) const {
+        if (filter_ != FILTER::NEAREST) { return sampleBilinear(*imagebuffer_ptr_, u, v); }
         // u, v to [0, 1]
         u = std::fmod(u, 1.0f);
         v = std::fmod(v, 1.0f);
@@ -40,10 +162,50 @@ public:
         return imagebuffer_ptr_->getValue(x, y);
     }
 
+    /**
+     * @brief Samples with the mip level chosen from the screen space derivatives of uv.
+     *
+     * ddx and ddy are the changes of uv from one pixel to the next in x and
+     * y, as passed to shaders with Shader::needsVaryingDerivatives(). The
+     * level is log2 of the longer of the two derivatives in texels of
+     * level 0.
+     */
+    inline RGBColor sample(const Vector2& uv, const Vector2& ddx, const Vector2& ddy) const {
+        return sampleLevel(uv, computeLevel(ddx, ddy));
+    }
+
+    // samples at the fractional mip level, clamped to the existing levels
+    inline RGBColor sampleLevel(const Vector2& uv, float level) const {
+        const float max_level = static_cast<float>(mip_levels_.size());
+        level = std::min(std::max(level, 0.0f), max_level);
+        if (filter_ != FILTER::TRILINEAR) {
+            const ImageBuffer& image = levelImage(static_cast<uint32_t>(level + 0.5f));
+            return filter_ == FILTER::NEAREST ? sampleNearest(image, uv.x, uv.y) : sampleBilinear(image, uv.x, uv.y);
+        }
+        const uint32_t level0 = static_cast<uint32_t>(level);
+        const RGBColor c0 = sampleBilinear(levelImage(level0), uv.x, uv.y);
+        if (level0 == mip_levels_.size()) return c0;
+        const RGBColor c1 = sampleBilinear(levelImage(level0 + 1), uv.x, uv.y);
+        const float t = level - static_cast<float>(level0);
+        return RGBColor{lerpChannel(c0.r, c1.r, t), lerpChannel(c0.g, c1.g, t), lerpChannel(c0.b, c1.b, t), lerpChannel(c0.a, c1.a, t)};
+    }
+
+    // mip level of the derivatives, negative when the texture is magnified
+    inline float computeLevel(const Vector2& ddx, const Vector2& ddy) const {
+        return mipLevel(imagebuffer_ptr_->getWidth(), imagebuffer_ptr_->getHeight(), ddx, ddy);
+    }
+
 private:
-    std::shared_ptr<GraphicsBuffer<RGBColor>> imagebuffer_;
+    inline const ImageBuffer& levelImage(uint32_t level) const { return level == 0 ? *imagebuffer_ptr_ : *mip_levels_[level - 1]; }
+
+    std::shared_ptr<ImageBuffer> imagebuffer_;
     // for fast access
-    GraphicsBuffer<RGBColor>* imagebuffer_ptr_;
+    ImageBuffer* imagebuffer_ptr_;
+    // levels 1 and below of generateMipmaps()
+    std::vector<std::shared_ptr<ImageBuffer>> mip_levels_;
+    FILTER filter_;
 };
 
+using Texture = TextureT<>;
+
 }
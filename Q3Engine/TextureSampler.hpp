@@ -0,0 +1,412 @@
+#pragma once
+
+#include "RGBColor.hpp"
+#include "Buffer.hpp"
+#include "Math.hpp"
+#include "Shader.hpp"
+#include "Simd.hpp"
+#include "Texture.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+namespace q3 {
+
+/**
+ * @brief Samples one level of a texture with precomputed addressing and fixed point filtering.
+ *
+ * The constructor caches everything sample() needs: the texel pointer, the
+ * sizes scaled to fixed point, the masks of power-of-two sizes and the row
+ * pitch. A sample wraps uv in float, converts it to texel coordinates with
+ * FRACTION_BITS fractional bits and addresses the texels with integer
+ * arithmetic, without data dependent branches. Bilinear filtering blends the
+ * 2x2 texels around uv with integer weights. Results are identical at every
+ * SIMD level, the nearest filter with REPEAT picks the same texel as
+ * TextureT::sample().
+ *
+ * The batch sample() works on arrays of u and v, eight lanes at a time with
+ * AVX2 gathers (linear layouts only), four with SSE2. sampleBlock() samples
+ * the masked lanes of a FragmentBlock for Shader::fragmentShaderBlock():
+ *
+ * @code
+ * void fragmentShaderBlock(const q3::Triangle&, const q3::FragmentBlock& block, void*, void*, void*, const void*, q3::RGBColor* colors) override {
+ *     sampler.sampleBlock(block, 0, colors); // uv are the varyings 0 and 1
+ * }
+ * @endcode
+ *
+ * The sampler keeps the image alive, it must not be written while sampling.
+ * Any float, including NaN and infinities, addresses a texel inside the image.
+ */
+template<typename Layout = LinearLayout>
+class TextureSamplerT {
+public:
+    using ImageBuffer = GraphicsBuffer<RGBColor, Layout>;
+
+    enum class FILTER {
+        NEAREST, // the texel containing uv
+        BILINEAR // the 2x2 texels around uv weighted by the distance to their centers
+    };
+
+    enum class ADDRESS_MODE {
+        REPEAT, // the image tiles the plane, the default
+        CLAMP,  // uv outside [0, 1] repeats the border texels
+        MIRROR  // the image tiles the plane with every other copy mirrored
+    };
+
+    static constexpr uint32_t FRACTION_BITS = 8;
+
+    TextureSamplerT(std::shared_ptr<ImageBuffer> image, FILTER filter = FILTER::NEAREST, ADDRESS_MODE address_mode = ADDRESS_MODE::REPEAT)
+        : image_(std::move(image)), filter_(filter), address_mode_(address_mode), simd_level_(detectSimdLevel()) {
+        if (image_ == nullptr || image_->getWidth() == 0 || image_->getHeight() == 0) { throw std::invalid_argument("the sampled image must not be empty"); }
+        if (image_->getWidth() > MAX_SIZE || image_->getHeight() > MAX_SIZE || image_->getLayout().size() > MAX_TEXELS) {
+            throw std::invalid_argument("the sampled image is too large for 32 bit texel addresses");
+        }
+        data_ = image_->getData();
+        layout_ = image_->getLayout();
+        width_ = static_cast<int32_t>(image_->getWidth());
+        height_ = static_cast<int32_t>(image_->getHeight());
+        width_mask_ = width_ - 1;
+        height_mask_ = height_ - 1;
+        power_of_two_ = (width_ & width_mask_) == 0 && (height_ & height_mask_) == 0;
+        scale_u_ = static_cast<float>(width_ << FRACTION_BITS);
+        scale_v_ = static_cast<float>(height_ << FRACTION_BITS);
+        // bilinear coordinates are relative to the texel centers
+        offset_ = filter == FILTER::BILINEAR ? HALF : 0;
+        if constexpr (Layout::LINEAR) {
+            pitch_ = static_cast<int32_t>(layout_.getPitch());
+        } else {
+            pitch_ = 0;
+        }
+    }
+
+    // samples mip level level of texture
+    TextureSamplerT(const TextureT<Layout>& texture, FILTER filter = FILTER::NEAREST, ADDRESS_MODE address_mode = ADDRESS_MODE::REPEAT, uint32_t level = 0)
+        : TextureSamplerT(texture.getLevel(level), filter, address_mode) {}
+
+    FILTER getFilter() const { return filter_; }
+    ADDRESS_MODE getAddressMode() const { return address_mode_; }
+    std::shared_ptr<ImageBuffer> getImageBuffer() const { return image_; }
+
+    // the batches use at most level, capped to what the CPU supports
+    void setSimdLevel(SIMD_LEVEL level) { simd_level_ = std::min(level, detectSimdLevel()); }
+    SIMD_LEVEL getSimdLevel() const { return simd_level_; }
+
+    inline RGBColor sample(const Vector2& uv) const { return sample(uv.x, uv.y); }
+    inline RGBColor sample(float u, float v) const {
+        switch (address_mode_) {
+        case ADDRESS_MODE::CLAMP: return filter_ == FILTER::NEAREST ? sampleScalar<ADDRESS_MODE::CLAMP, false>(u, v) : sampleScalar<ADDRESS_MODE::CLAMP, true>(u, v);
+        case ADDRESS_MODE::MIRROR: return filter_ == FILTER::NEAREST ? sampleScalar<ADDRESS_MODE::MIRROR, false>(u, v) : sampleScalar<ADDRESS_MODE::MIRROR, true>(u, v);
+        case ADDRESS_MODE::REPEAT:
+        default: return filter_ == FILTER::NEAREST ? sampleScalar<ADDRESS_MODE::REPEAT, false>(u, v) : sampleScalar<ADDRESS_MODE::REPEAT, true>(u, v);
+        }
+    }
+
+    // samples (u[i], v[i]) into colors[i] for i < count, same results as count calls of sample(u, v)
+    inline void sample(const float* u, const float* v, uint32_t count, RGBColor* colors) const {
+        switch (address_mode_) {
+        case ADDRESS_MODE::CLAMP: sampleBatch<ADDRESS_MODE::CLAMP>(u, v, count, colors); break;
+        case ADDRESS_MODE::MIRROR: sampleBatch<ADDRESS_MODE::MIRROR>(u, v, count, colors); break;
+        case ADDRESS_MODE::REPEAT:
+        default: sampleBatch<ADDRESS_MODE::REPEAT>(u, v, count, colors); break;
+        }
+    }
+
+    // samples the masked lanes of block at the uv in its varyings u_varying and u_varying + 1, the other colors are left unchanged
+    inline void sampleBlock(const FragmentBlock& block, uint32_t u_varying, RGBColor* colors) const {
+        if (u_varying + 1 >= block.varying_count) { throw std::invalid_argument("uv must be two interpolated varyings of the block"); }
+        // the masked lanes are packed into full batches, the varyings of the other lanes are unspecified
+        alignas(32) float u[FragmentBlock::LANES];
+        alignas(32) float v[FragmentBlock::LANES];
+        uint8_t lanes[FragmentBlock::LANES];
+        RGBColor packed[FragmentBlock::LANES];
+        uint32_t count = 0;
+        for (uint64_t mask = block.mask; mask != 0; mask &= mask - 1) {
+            const uint32_t lane = countTrailingZeros(mask);
+            u[count] = block.varyings[u_varying][lane];
+            v[count] = block.varyings[u_varying + 1][lane];
+            lanes[count++] = static_cast<uint8_t>(lane);
+        }
+        sample(u, v, count, packed);
+        for (uint32_t i = 0; i < count; i++) { colors[lanes[i]] = packed[i]; }
+    }
+
+private:
+    static constexpr int32_t ONE = 1 << FRACTION_BITS;
+    static constexpr int32_t HALF = ONE >> 1;
+    static constexpr int32_t WEIGHT_MASK = ONE - 1;
+    // sizes keep the fixed point coordinates of uv in [0, 1] below 2^31
+    static constexpr uint32_t MAX_SIZE = 1u << (30 - FRACTION_BITS);
+    // byte offsets of the gathers are 32 bit
+    static constexpr std::size_t MAX_TEXELS = static_cast<std::size_t>(1) << 29;
+    // uv are clamped to this range first, so NaN and infinities become finite and floor() fits into 32 bits
+    static constexpr float COORDINATE_LIMIT = 4194304.0f;
+
+    // uv wrapped into [0, 1], addresses outside the image only remain at the borders
+    template<ADDRESS_MODE MODE>
+    static inline float addressCoordinate(float u) {
+        // std::max returns its first argument for NaN
+        u = std::min(COORDINATE_LIMIT, std::max(-COORDINATE_LIMIT, u));
+        if constexpr (MODE == ADDRESS_MODE::REPEAT) {
+            return u - std::floor(u);
+        } else if constexpr (MODE == ADDRESS_MODE::MIRROR) {
+            const float period = u - 2.0f * std::floor(u * 0.5f);
+            return 1.0f - std::fabs(period - 1.0f);
+        } else {
+            return std::min(1.0f, std::max(0.0f, u));
+        }
+    }
+
+    // texel index i in [-1, size] moved into the image
+    template<ADDRESS_MODE MODE>
+    inline int32_t addressTexel(int32_t i, int32_t size, int32_t mask) const {
+        if constexpr (MODE == ADDRESS_MODE::REPEAT) {
+            if (power_of_two_) return i & mask;
+            i += size & (i >> 31);
+            return i - (size & ~((i - size) >> 31));
+        } else {
+            // mirroring at the border repeats the border texel like clamping
+            return std::min(std::max(i, 0), size - 1);
+        }
+    }
+
+    inline const RGBColor& texel(int32_t x, int32_t y) const {
+        // rows are stored from v = 1 down
+        return data_[layout_.index(static_cast<uint32_t>(x), static_cast<uint32_t>(height_mask_ - y))];
+    }
+
+    // (a * (ONE - weight) + b * weight) / ONE rounded to nearest
+    static inline uint8_t lerp(uint8_t a, uint8_t b, int32_t weight) {
+        return static_cast<uint8_t>((a * (ONE - weight) + b * weight + HALF) >> FRACTION_BITS);
+    }
+    static inline RGBColor lerp(const RGBColor& a, const RGBColor& b, int32_t weight) {
+        return RGBColor{lerp(a.r, b.r, weight), lerp(a.g, b.g, weight), lerp(a.b, b.b, weight), lerp(a.a, b.a, weight)};
+    }
+
+    template<ADDRESS_MODE MODE, bool BILINEAR>
+    inline RGBColor sampleScalar(float u, float v) const {
+        const int32_t fx = static_cast<int32_t>(addressCoordinate<MODE>(u) * scale_u_) - offset_;
+        const int32_t fy = static_cast<int32_t>(addressCoordinate<MODE>(v) * scale_v_) - offset_;
+        const int32_t x0 = addressTexel<MODE>(fx >> FRACTION_BITS, width_, width_mask_);
+        const int32_t y0 = addressTexel<MODE>(fy >> FRACTION_BITS, height_, height_mask_);
+        if constexpr (!BILINEAR) {
+            return texel(x0, y0);
+        } else {
+            const int32_t x1 = addressTexel<MODE>((fx >> FRACTION_BITS) + 1, width_, width_mask_);
+            const int32_t y1 = addressTexel<MODE>((fy >> FRACTION_BITS) + 1, height_, height_mask_);
+            const int32_t wx = fx & WEIGHT_MASK;
+            const int32_t wy = fy & WEIGHT_MASK;
+            return lerp(lerp(texel(x0, y0), texel(x1, y0), wx), lerp(texel(x0, y1), texel(x1, y1), wx), wy);
+        }
+    }
+
+    template<ADDRESS_MODE MODE>
+    inline void sampleBatch(const float* u, const float* v, uint32_t count, RGBColor* colors) const {
+        if (filter_ == FILTER::NEAREST) {
+            sampleBatch<MODE, false>(u, v, count, colors);
+        } else {
+            sampleBatch<MODE, true>(u, v, count, colors);
+        }
+    }
+
+    template<ADDRESS_MODE MODE, bool BILINEAR>
+    inline void sampleBatch(const float* u, const float* v, uint32_t count, RGBColor* colors) const {
+        static_assert(sizeof(RGBColor) == 4, "RGBColor must be 4 packed bytes");
+        uint32_t i = 0;
+#ifdef Q3_AVX2
+        if constexpr (Layout::LINEAR) {
+            if (simd_level_ == SIMD_LEVEL::AVX2) {
+                for (; i + 8 <= count; i += 8) { sampleAvx2<MODE, BILINEAR>(u + i, v + i, colors + i); }
+            }
+        }
+#endif
+#ifdef Q3_SSE2
+        if (simd_level_ != SIMD_LEVEL::SCALAR) {
+            for (; i + 4 <= count; i += 4) { sampleSse2<MODE, BILINEAR>(u + i, v + i, colors + i); }
+        }
+#endif
+        for (; i < count; i++) { colors[i] = sampleScalar<MODE, BILINEAR>(u[i], v[i]); }
+    }
+
+#ifdef Q3_SSE2
+    static inline __m128 floorSse2(__m128 x) {
+        // truncation rounds negative values up, x is within COORDINATE_LIMIT
+        const __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+        return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1.0f)));
+    }
+
+    template<ADDRESS_MODE MODE>
+    static inline __m128 addressCoordinateSse2(__m128 u) {
+        // _mm_max_ps returns its second argument for NaN
+        u = _mm_min_ps(_mm_max_ps(u, _mm_set1_ps(-COORDINATE_LIMIT)), _mm_set1_ps(COORDINATE_LIMIT));
+        if constexpr (MODE == ADDRESS_MODE::REPEAT) {
+            return _mm_sub_ps(u, floorSse2(u));
+        } else if constexpr (MODE == ADDRESS_MODE::MIRROR) {
+            const __m128 period = _mm_sub_ps(u, _mm_mul_ps(_mm_set1_ps(2.0f), floorSse2(_mm_mul_ps(u, _mm_set1_ps(0.5f)))));
+            const __m128 distance = _mm_sub_ps(period, _mm_set1_ps(1.0f));
+            const __m128 abs_distance = _mm_andnot_ps(_mm_set1_ps(-0.0f), distance);
+            return _mm_sub_ps(_mm_set1_ps(1.0f), abs_distance);
+        } else {
+            return _mm_min_ps(_mm_max_ps(u, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+        }
+    }
+
+    template<ADDRESS_MODE MODE>
+    inline __m128i addressTexelSse2(__m128i i, int32_t size, int32_t mask) const {
+        if constexpr (MODE == ADDRESS_MODE::REPEAT) {
+            if (power_of_two_) return _mm_and_si128(i, _mm_set1_epi32(mask));
+            const __m128i size4 = _mm_set1_epi32(size);
+            i = _mm_add_epi32(i, _mm_and_si128(size4, _mm_srai_epi32(i, 31)));
+            return _mm_sub_epi32(i, _mm_andnot_si128(_mm_srai_epi32(_mm_sub_epi32(i, size4), 31), size4));
+        } else {
+            i = _mm_andnot_si128(_mm_srai_epi32(i, 31), i);
+            const __m128i over = _mm_sub_epi32(i, _mm_set1_epi32(size - 1));
+            return _mm_sub_epi32(i, _mm_andnot_si128(_mm_srai_epi32(over, 31), over));
+        }
+    }
+
+    // lerp() of 16 bit channels, the sums stay below 2^16
+    static inline __m128i lerpWordsSse2(__m128i a, __m128i b, __m128i weight) {
+        const __m128i sum = _mm_add_epi16(_mm_mullo_epi16(a, _mm_sub_epi16(_mm_set1_epi16(ONE), weight)), _mm_mullo_epi16(b, weight));
+        return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(HALF)), FRACTION_BITS);
+    }
+
+    template<ADDRESS_MODE MODE, bool BILINEAR>
+    inline void sampleSse2(const float* u, const float* v, RGBColor* colors) const {
+        const __m128i fx = _mm_sub_epi32(_mm_cvttps_epi32(_mm_mul_ps(addressCoordinateSse2<MODE>(_mm_loadu_ps(u)), _mm_set1_ps(scale_u_))), _mm_set1_epi32(offset_));
+        const __m128i fy = _mm_sub_epi32(_mm_cvttps_epi32(_mm_mul_ps(addressCoordinateSse2<MODE>(_mm_loadu_ps(v)), _mm_set1_ps(scale_v_))), _mm_set1_epi32(offset_));
+        alignas(16) int32_t x0[4], y0[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(x0), addressTexelSse2<MODE>(_mm_srai_epi32(fx, FRACTION_BITS), width_, width_mask_));
+        _mm_store_si128(reinterpret_cast<__m128i*>(y0), addressTexelSse2<MODE>(_mm_srai_epi32(fy, FRACTION_BITS), height_, height_mask_));
+        if constexpr (!BILINEAR) {
+            for (uint32_t lane = 0; lane < 4; lane++) { colors[lane] = texel(x0[lane], y0[lane]); }
+        } else {
+            const __m128i one = _mm_set1_epi32(1);
+            alignas(16) int32_t x1[4], y1[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(x1), addressTexelSse2<MODE>(_mm_add_epi32(_mm_srai_epi32(fx, FRACTION_BITS), one), width_, width_mask_));
+            _mm_store_si128(reinterpret_cast<__m128i*>(y1), addressTexelSse2<MODE>(_mm_add_epi32(_mm_srai_epi32(fy, FRACTION_BITS), one), height_, height_mask_));
+            alignas(16) RGBColor c00[4], c10[4], c01[4], c11[4];
+            for (uint32_t lane = 0; lane < 4; lane++) {
+                c00[lane] = texel(x0[lane], y0[lane]);
+                c10[lane] = texel(x1[lane], y0[lane]);
+                c01[lane] = texel(x0[lane], y1[lane]);
+                c11[lane] = texel(x1[lane], y1[lane]);
+            }
+            // the weight of a pixel in the four 16 bit channels of the pixel, in the order of the byte unpacking
+            const __m128i weight_mask = _mm_set1_epi32(WEIGHT_MASK);
+            const __m128i wx = _mm_and_si128(fx, weight_mask);
+            const __m128i wy = _mm_and_si128(fy, weight_mask);
+            const __m128i wx2 = _mm_or_si128(wx, _mm_slli_epi32(wx, 16));
+            const __m128i wy2 = _mm_or_si128(wy, _mm_slli_epi32(wy, 16));
+            const __m128i zero = _mm_setzero_si128();
+            auto load = [](const RGBColor* c) { return _mm_load_si128(reinterpret_cast<const __m128i*>(c)); };
+            const __m128i t00 = load(c00), t10 = load(c10), t01 = load(c01), t11 = load(c11);
+            __m128i halves[2];
+            for (uint32_t half = 0; half < 2; half++) {
+                auto unpack = [&](__m128i t) { return half == 0 ? _mm_unpacklo_epi8(t, zero) : _mm_unpackhi_epi8(t, zero); };
+                const __m128i weight_x = half == 0 ? _mm_unpacklo_epi32(wx2, wx2) : _mm_unpackhi_epi32(wx2, wx2);
+                const __m128i weight_y = half == 0 ? _mm_unpacklo_epi32(wy2, wy2) : _mm_unpackhi_epi32(wy2, wy2);
+                const __m128i top = lerpWordsSse2(unpack(t00), unpack(t10), weight_x);
+                const __m128i bottom = lerpWordsSse2(unpack(t01), unpack(t11), weight_x);
+                halves[half] = lerpWordsSse2(top, bottom, weight_y);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(colors), _mm_packus_epi16(halves[0], halves[1]));
+        }
+    }
+#endif
+
+#ifdef Q3_AVX2
+    template<ADDRESS_MODE MODE>
+    Q3_TARGET_AVX2 static inline __m256 addressCoordinateAvx2(__m256 u) {
+        u = _mm256_min_ps(_mm256_max_ps(u, _mm256_set1_ps(-COORDINATE_LIMIT)), _mm256_set1_ps(COORDINATE_LIMIT));
+        if constexpr (MODE == ADDRESS_MODE::REPEAT) {
+            return _mm256_sub_ps(u, _mm256_floor_ps(u));
+        } else if constexpr (MODE == ADDRESS_MODE::MIRROR) {
+            const __m256 period = _mm256_sub_ps(u, _mm256_mul_ps(_mm256_set1_ps(2.0f), _mm256_floor_ps(_mm256_mul_ps(u, _mm256_set1_ps(0.5f)))));
+            const __m256 distance = _mm256_sub_ps(period, _mm256_set1_ps(1.0f));
+            return _mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_andnot_ps(_mm256_set1_ps(-0.0f), distance));
+        } else {
+            return _mm256_min_ps(_mm256_max_ps(u, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+        }
+    }
+
+    template<ADDRESS_MODE MODE>
+    Q3_TARGET_AVX2 inline __m256i addressTexelAvx2(__m256i i, int32_t size, int32_t mask) const {
+        if constexpr (MODE == ADDRESS_MODE::REPEAT) {
+            if (power_of_two_) return _mm256_and_si256(i, _mm256_set1_epi32(mask));
+            const __m256i size8 = _mm256_set1_epi32(size);
+            i = _mm256_add_epi32(i, _mm256_and_si256(size8, _mm256_srai_epi32(i, 31)));
+            return _mm256_sub_epi32(i, _mm256_andnot_si256(_mm256_srai_epi32(_mm256_sub_epi32(i, size8), 31), size8));
+        } else {
+            return _mm256_min_epi32(_mm256_max_epi32(i, _mm256_setzero_si256()), _mm256_set1_epi32(size - 1));
+        }
+    }
+
+    Q3_TARGET_AVX2 static inline __m256i lerpWordsAvx2(__m256i a, __m256i b, __m256i weight) {
+        const __m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(a, _mm256_sub_epi16(_mm256_set1_epi16(ONE), weight)), _mm256_mullo_epi16(b, weight));
+        return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(HALF)), FRACTION_BITS);
+    }
+
+    // storage index of the texel, the rows are flipped like texel()
+    Q3_TARGET_AVX2 inline __m256i texelIndexAvx2(__m256i x, __m256i y) const {
+        return _mm256_add_epi32(x, _mm256_mullo_epi32(_mm256_sub_epi32(_mm256_set1_epi32(height_mask_), y), _mm256_set1_epi32(pitch_)));
+    }
+
+    template<ADDRESS_MODE MODE, bool BILINEAR>
+    Q3_TARGET_AVX2 inline void sampleAvx2(const float* u, const float* v, RGBColor* colors) const {
+        const int* base = reinterpret_cast<const int*>(data_);
+        const __m256i fx = _mm256_sub_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(addressCoordinateAvx2<MODE>(_mm256_loadu_ps(u)), _mm256_set1_ps(scale_u_))),
+                                            _mm256_set1_epi32(offset_));
+        const __m256i fy = _mm256_sub_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(addressCoordinateAvx2<MODE>(_mm256_loadu_ps(v)), _mm256_set1_ps(scale_v_))),
+                                            _mm256_set1_epi32(offset_));
+        const __m256i x0 = addressTexelAvx2<MODE>(_mm256_srai_epi32(fx, FRACTION_BITS), width_, width_mask_);
+        const __m256i y0 = addressTexelAvx2<MODE>(_mm256_srai_epi32(fy, FRACTION_BITS), height_, height_mask_);
+        if constexpr (!BILINEAR) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(colors), _mm256_i32gather_epi32(base, texelIndexAvx2(x0, y0), 4));
+        } else {
+            const __m256i one = _mm256_set1_epi32(1);
+            const __m256i x1 = addressTexelAvx2<MODE>(_mm256_add_epi32(_mm256_srai_epi32(fx, FRACTION_BITS), one), width_, width_mask_);
+            const __m256i y1 = addressTexelAvx2<MODE>(_mm256_add_epi32(_mm256_srai_epi32(fy, FRACTION_BITS), one), height_, height_mask_);
+            const __m256i t00 = _mm256_i32gather_epi32(base, texelIndexAvx2(x0, y0), 4);
+            const __m256i t10 = _mm256_i32gather_epi32(base, texelIndexAvx2(x1, y0), 4);
+            const __m256i t01 = _mm256_i32gather_epi32(base, texelIndexAvx2(x0, y1), 4);
+            const __m256i t11 = _mm256_i32gather_epi32(base, texelIndexAvx2(x1, y1), 4);
+            const __m256i weight_mask = _mm256_set1_epi32(WEIGHT_MASK);
+            const __m256i wx = _mm256_and_si256(fx, weight_mask);
+            const __m256i wy = _mm256_and_si256(fy, weight_mask);
+            const __m256i wx2 = _mm256_or_si256(wx, _mm256_slli_epi32(wx, 16));
+            const __m256i wy2 = _mm256_or_si256(wy, _mm256_slli_epi32(wy, 16));
+            const __m256i zero = _mm256_setzero_si256();
+            // unpacking works within the 128 bit halves, the weights are spread in the same order
+            const __m256i lo = lerpWordsAvx2(lerpWordsAvx2(_mm256_unpacklo_epi8(t00, zero), _mm256_unpacklo_epi8(t10, zero), _mm256_unpacklo_epi32(wx2, wx2)),
+                                             lerpWordsAvx2(_mm256_unpacklo_epi8(t01, zero), _mm256_unpacklo_epi8(t11, zero), _mm256_unpacklo_epi32(wx2, wx2)),
+                                             _mm256_unpacklo_epi32(wy2, wy2));
+            const __m256i hi = lerpWordsAvx2(lerpWordsAvx2(_mm256_unpackhi_epi8(t00, zero), _mm256_unpackhi_epi8(t10, zero), _mm256_unpackhi_epi32(wx2, wx2)),
+                                             lerpWordsAvx2(_mm256_unpackhi_epi8(t01, zero), _mm256_unpackhi_epi8(t11, zero), _mm256_unpackhi_epi32(wx2, wx2)),
+                                             _mm256_unpackhi_epi32(wy2, wy2));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(colors), _mm256_packus_epi16(lo, hi));
+        }
+    }
+#endif
+
+    std::shared_ptr<ImageBuffer> image_;
+    // for fast access
+    const RGBColor* data_;
+    Layout layout_;
+    FILTER filter_;
+    ADDRESS_MODE address_mode_;
+    SIMD_LEVEL simd_level_;
+    int32_t width_, height_;
+    int32_t width_mask_, height_mask_; // size - 1, the repeat masks if power_of_two_
+    bool power_of_two_;
+    float scale_u_, scale_v_; // sizes in fixed point
+    int32_t offset_;          // fixed point offset of the first texel center
+    int32_t pitch_;           // elements per row of the linear layout
+};
+
+using TextureSampler = TextureSamplerT<>;
+
+}
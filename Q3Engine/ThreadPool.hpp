@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace q3 {
+
+/**
+ * @brief A minimal fork-join worker pool.
+ *
+ * parallelFor() hands out the indices [0, count) dynamically to the worker
+ * threads and to the calling thread, and returns once every index has been
+ * processed. The calling thread always participates as thread index 0, so a
+ * pool of N threads spawns N - 1 workers.
+ *
+ * Usage example:
+ * @code
+ * q3::ThreadPool pool(8);
+ * pool.parallelFor(rows, [&](uint32_t row, uint32_t thread_index) {
+ *     processRow(row, scratch[thread_index]);
+ * });
+ * @endcode
+ *
+ * @note The first exception thrown by a job is rethrown from parallelFor()
+ *       after all threads have stopped working on the batch.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(uint32_t thread_count)
+        : stop_(false), generation_(0), pending_(0), job_count_(0), next_(0) {
+        if (thread_count == 0) { thread_count = 1; }
+        workers_.reserve(thread_count - 1);
+        for (uint32_t i = 1; i < thread_count; i++) {
+            workers_.emplace_back([this, i]() { workerLoop(i); });
+        }
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_cv_.notify_all();
+        for (auto& worker : workers_) { worker.join(); }
+    }
+
+    uint32_t getThreadCount() const { return static_cast<uint32_t>(workers_.size()) + 1; }
+
+    template<typename F>
+    void parallelFor(uint32_t count, F&& func) {
+        if (count == 0) return;
+        if (workers_.empty() || count == 1) {
+            for (uint32_t i = 0; i < count; i++) { func(i, 0); }
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = [&func](uint32_t index, uint32_t thread_index) { func(index, thread_index); };
+            job_count_ = count;
+            next_.store(0, std::memory_order_relaxed);
+            pending_ = static_cast<uint32_t>(workers_.size());
+            exception_ = nullptr;
+            generation_++;
+        }
+        wake_cv_.notify_all();
+        runJobs(0);
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this]() { return pending_ == 0; });
+        job_ = nullptr;
+        if (exception_) { std::rethrow_exception(std::exchange(exception_, nullptr)); }
+    }
+
+private:
+    inline void runJobs(uint32_t thread_index) {
+        try {
+            for (uint32_t i = next_.fetch_add(1, std::memory_order_relaxed); i < job_count_; i = next_.fetch_add(1, std::memory_order_relaxed)) {
+                job_(i, thread_index);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!exception_) { exception_ = std::current_exception(); }
+            // drain the remaining jobs so the other threads stop early
+            next_.store(job_count_, std::memory_order_relaxed);
+        }
+    }
+
+    inline void workerLoop(uint32_t thread_index) {
+        uint64_t seen_generation = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_cv_.wait(lock, [&]() { return stop_ || generation_ != seen_generation; });
+                if (stop_) return;
+                seen_generation = generation_;
+            }
+            runJobs(thread_index);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--pending_ == 0) { done_cv_.notify_one(); }
+            }
+        }
+    }
+
+private:
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_cv_;
+    std::condition_variable done_cv_;
+    bool stop_;
+    uint64_t generation_;
+    uint32_t pending_;
+    // current batch
+    std::function<void(uint32_t, uint32_t)> job_;
+    uint32_t job_count_;
+    std::atomic<uint32_t> next_;
+    std::exception_ptr exception_;
+};
+
+}
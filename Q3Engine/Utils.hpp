@@ -3,16 +3,27 @@
 #include "Buffer.hpp"
 #include "RGBColor.hpp"
 #include "Math.hpp"
+#include "ThreadPool.hpp"
 
+#include <algorithm>
+#include <charconv>
 #include <cstdint>
 #include <stdexcept>
 #include <fstream>
-#include <sstream>
+#include <iterator>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
-#include <map>
 #include <memory>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace q3 {
 
 struct ObjData {
@@ -22,89 +33,350 @@ struct ObjData {
     std::shared_ptr<DataBuffer<uint32_t>> indices;
 };
 
-ObjData loadObjFile(const std::string& filename) {
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        throw std::runtime_error("Failed to open file: " + filename);
+/**
+ * @brief The contents of a file, memory-mapped where the platform supports it.
+ *
+ * Read-only; on Windows the file is read into memory instead.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filename) : data_(nullptr), size_(0) {
+#ifdef _WIN32
+        std::ifstream file(filename, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Failed to open file: " + filename);
+        }
+        contents_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        data_ = contents_.data();
+        size_ = contents_.size();
+#else
+        const int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open file: " + filename);
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Failed to read file: " + filename);
+        }
+        size_ = static_cast<std::size_t>(info.st_size);
+        if (size_ > 0) {
+            void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Failed to map file: " + filename);
+            }
+            data_ = static_cast<const char*>(data);
+#ifdef __linux__
+            // read ahead aggressively, every page is parsed once from front to back
+            ::madvise(data, size_, MADV_SEQUENTIAL);
+#endif
+        }
+        // the mapping keeps the file alive
+        ::close(fd);
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (data_ != nullptr) { ::munmap(const_cast<char*>(data_), size_); }
+#endif
     }
 
-    std::vector<float> v;
-    std::vector<float> vt;
-    std::vector<float> vn;
-    std::map<std::string, uint32_t> indices_map;
-    uint32_t vertex_map_size = 0;
-    DataBuffer<uint32_t> indices;
+    std::string_view getContents() const { return std::string_view(data_, size_); }
 
-    std::string line;
-    while (std::getline(file, line)) {
-        // truncate string after # (comments)
-        size_t comment_pos = line.find('#');
-        if (comment_pos != std::string::npos) {
-            line = line.substr(0, comment_pos);
+private:
+    const char* data_;
+    std::size_t size_;
+#ifdef _WIN32
+    std::string contents_;
+#endif
+};
+
+// the whitespace of std::isspace() in the "C" locale
+inline bool isObjSpace(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+// parses like std::stof(), the fallback handles what std::from_chars() does not (a leading '+', hex floats, trailing characters)
+inline float parseObjFloat(std::string_view token) {
+    float value;
+    const auto result = std::from_chars(token.data(), token.data() + token.size(), value);
+    if (result.ec == std::errc() && result.ptr == token.data() + token.size()) { return value; }
+    return std::stof(std::string(token));
+}
+
+// parses like std::stoi()
+inline int32_t parseObjIndex(std::string_view token) {
+    int32_t value;
+    const auto result = std::from_chars(token.data(), token.data() + token.size(), value);
+    if (result.ec == std::errc() && result.ptr == token.data() + token.size()) { return value; }
+    return std::stoi(std::string(token));
+}
+
+// 1-based vertex, uv and normal index of a face corner, 0 when the corner has no uv or normal
+struct ObjCorner {
+    uint32_t vertex, uv, normal;
+};
+
+/**
+ * @brief Assigns consecutive ids to distinct face corners, in the order they are first added.
+ *
+ * An open addressing hash table with linear probing over the index triples,
+ * kept at most half full, so its size follows the number of distinct
+ * corners and not the vertex indices. Vertex index 0 marks the empty slots.
+ * Every chunk of loadObjFile() dedups its corners in one.
+ */
+class ObjCornerHash {
+public:
+    ObjCornerHash() : entries_(1024), mask_(1023) {}
+
+    // the id of corner, a new one when it was not added before
+    inline uint32_t add(const ObjCorner& corner) {
+        if (2 * (corners_.size() + 1) > entries_.size()) { grow(); }
+        Entry& entry = find(corner);
+        if (entry.corner.vertex == 0) {
+            entry.corner = corner;
+            entry.id = static_cast<uint32_t>(corners_.size());
+            corners_.push_back(corner);
+        }
+        return entry.id;
+    }
+
+    // the distinct corners by id
+    const std::vector<ObjCorner>& getCorners() const { return corners_; }
+
+private:
+    struct Entry {
+        ObjCorner corner;
+        uint32_t id;
+    };
+
+    inline Entry& find(const ObjCorner& corner) {
+        const uint64_t key = (static_cast<uint64_t>(corner.vertex) | static_cast<uint64_t>(corner.uv) << 32) * 0x9e3779b97f4a7c15ull ^
+                             static_cast<uint64_t>(corner.normal) * 0xc2b2ae3d27d4eb4full;
+        for (std::size_t slot = static_cast<std::size_t>(key >> 32) & mask_;; slot = (slot + 1) & mask_) {
+            Entry& entry = entries_[slot];
+            if (entry.corner.vertex == 0 ||
+                (entry.corner.vertex == corner.vertex && entry.corner.uv == corner.uv && entry.corner.normal == corner.normal)) {
+                return entry;
+            }
+        }
+    }
+
+    void grow() {
+        std::vector<Entry> entries(entries_.size() * 2);
+        entries_.swap(entries);
+        mask_ = entries_.size() - 1;
+        for (const Entry& entry : entries) {
+            if (entry.corner.vertex != 0) { find(entry.corner) = entry; }
+        }
+    }
+
+    std::vector<Entry> entries_;
+    std::size_t mask_;
+    std::vector<ObjCorner> corners_;
+};
+
+/**
+ * @brief Assigns consecutive ids to distinct face corners, like ObjCornerHash, with a bucket per vertex index.
+ *
+ * The corners sharing a vertex index are chained. The buckets span the
+ * vertex indices 1 to vertex_count, so loadObjFile() uses a single table,
+ * sized by the vertices of the whole file, to merge the corners of its
+ * chunks. Corners of consecutive chunks
+ * reference nearby vertices, so their buckets share cache lines, and a
+ * vertex rarely has more than a few uv and normal combinations.
+ */
+class ObjCornerTable {
+public:
+    explicit ObjCornerTable(std::size_t vertex_count) : heads_(vertex_count + 1, NONE) {}
+
+    // the id of corner, a new one when it was not added before, the vertex index must be at most vertex_count
+    inline uint32_t add(const ObjCorner& corner) {
+        uint32_t* link = &heads_[corner.vertex];
+        while (*link != NONE) {
+            const ObjCorner& other = corners_[*link];
+            if (other.uv == corner.uv && other.normal == corner.normal) { return *link; }
+            link = &next_[*link];
         }
-        // split line by spaces
-        std::istringstream line_iss(line);
-        std::vector<std::string> line_sp;
-        std::string segment;
-        while (line_iss >> segment) { line_sp.push_back(segment); }
-        // skip empty lines
-        if (line_sp.empty()) { continue; }
-        // TODO:
-        //   1. handle more obj file features
-
-        if (line_sp[0] == "v") {
-            v.push_back(std::stof(line_sp[1]));
-            v.push_back(std::stof(line_sp[2]));
-            v.push_back(std::stof(line_sp[3]));
-        } else if (line_sp[0] == "vt") {
-            vt.push_back(std::stof(line_sp[1]));
-            vt.push_back(std::stof(line_sp[2]));
-        } else if (line_sp[0] == "vn") {
-            vn.push_back(std::stof(line_sp[1]));
-            vn.push_back(std::stof(line_sp[2]));
-            vn.push_back(std::stof(line_sp[3]));
-        } else if (line_sp[0] == "f") {
-            for (size_t i = 1; i < line_sp.size(); ++i) {
-                if (indices_map.find(line_sp[i]) == indices_map.end()) {
-                    indices_map[line_sp[i]] = vertex_map_size++;
+        const uint32_t id = static_cast<uint32_t>(corners_.size());
+        *link = id;
+        corners_.push_back(corner);
+        next_.push_back(NONE);
+        return id;
+    }
+
+    // the distinct corners by id
+    const std::vector<ObjCorner>& getCorners() const { return corners_; }
+
+private:
+    static constexpr uint32_t NONE = ~0u;
+
+    // the first corner of every vertex index and the next corner of every corner with the same vertex index
+    std::vector<uint32_t> heads_;
+    std::vector<uint32_t> next_;
+    std::vector<ObjCorner> corners_;
+};
+
+// what a run of whole lines of an OBJ file declares, the indices refer to the corners of its own table
+struct ObjChunk {
+    std::vector<float> v, vt, vn;
+    ObjCornerHash corners;
+    std::vector<uint32_t> indices;
+};
+
+// parses whole lines, the indices are checked against the coordinates of the whole file by loadObjFile()
+inline void parseObjChunk(std::string_view text, ObjChunk& chunk) {
+    std::string_view tokens[3];
+    std::vector<uint32_t> face;
+    std::size_t line_begin = 0;
+    while (line_begin < text.size()) {
+        std::size_t line_end = text.find('\n', line_begin);
+        if (line_end == std::string_view::npos) { line_end = text.size(); }
+        std::string_view line = text.substr(line_begin, line_end - line_begin);
+        line_begin = line_end + 1;
+        // truncate string after # (comments)
+        const std::size_t comment_pos = line.find('#');
+        if (comment_pos != std::string_view::npos) { line = line.substr(0, comment_pos); }
+        // splits off the next token of line, empty at the end of the line
+        auto next = [&line]() {
+            std::size_t begin = 0;
+            while (begin < line.size() && isObjSpace(line[begin])) { begin++; }
+            std::size_t end = begin;
+            while (end < line.size() && !isObjSpace(line[end])) { end++; }
+            const std::string_view token = line.substr(begin, end - begin);
+            line = line.substr(end);
+            return token;
+        };
+        const std::string_view keyword = next();
+        if (keyword.empty()) { continue; }
+        if (keyword == "v" || keyword == "vn" || keyword == "vt") {
+            std::vector<float>& values = keyword == "v" ? chunk.v : keyword == "vt" ? chunk.vt : chunk.vn;
+            const uint32_t count = keyword == "vt" ? 2 : 3;
+            for (uint32_t i = 0; i < count; i++) {
+                tokens[i] = next();
+                if (tokens[i].empty()) { throw std::runtime_error("Missing coordinates in OBJ line: " + std::string(keyword)); }
+            }
+            for (uint32_t i = 0; i < count; i++) { values.push_back(parseObjFloat(tokens[i])); }
+        } else if (keyword == "f") {
+            face.clear();
+            for (std::string_view token = next(); !token.empty(); token = next()) {
+                // vertex/uv/normal, uv and normal are optional
+                ObjCorner corner{0, 0, 0};
+                uint32_t* parts[3] = {&corner.vertex, &corner.uv, &corner.normal};
+                for (uint32_t i = 0; i < 3 && !token.empty(); i++) {
+                    const std::size_t slash = token.find('/');
+                    const std::string_view part = token.substr(0, slash);
+                    token = slash == std::string_view::npos ? std::string_view() : token.substr(slash + 1);
+                    if (part.empty() && i > 0) { continue; }
+                    const int32_t index = parseObjIndex(part);
+                    if (index <= 0) { throw std::runtime_error("Unsupported OBJ index: " + std::to_string(index)); }
+                    *parts[i] = static_cast<uint32_t>(index);
                 }
+                face.push_back(chunk.corners.add(corner));
             }
-            for (size_t i = 2; i < line_sp.size() - 1; ++i) {
-                indices.push_back(indices_map[line_sp[1]]);
-                indices.push_back(indices_map[line_sp[i]]);
-                indices.push_back(indices_map[line_sp[i + 1]]);
+            // triangle fan around the first corner
+            for (std::size_t i = 2; i < face.size(); ++i) {
+                chunk.indices.push_back(face[0]);
+                chunk.indices.push_back(face[i - 1]);
+                chunk.indices.push_back(face[i]);
             }
         }
     }
+}
 
-    DataBuffer<Vector3> vertices(vertex_map_size);
-    DataBuffer<Vector2> uvs(vertex_map_size);
-    DataBuffer<Vector3> normals(vertex_map_size);
+/**
+ * @brief Loads the vertices, uvs, normals and triangles of an OBJ file.
+ *
+ * Every distinct vertex/uv/normal index triple of the faces becomes one
+ * vertex, numbered in the order the triples first appear, and polygons are
+ * split into triangle fans. Other statements are ignored.
+ *
+ * The file is memory-mapped and cut into chunks of whole lines that are
+ * parsed in parallel on thread_count threads, each deduplicating its own
+ * corners. The distinct corners of the chunks are then merged in file
+ * order, which keeps the numbering of a sequential parse. Corners are
+ * compared by their indices, so 1/2 and 01/2/ share a vertex.
+ */
+inline ObjData loadObjFile(const std::string& filename, uint32_t thread_count = std::thread::hardware_concurrency()) {
+    const MappedFile file(filename);
+    const std::string_view text = file.getContents();
 
-    for (const auto& [key, value] : indices_map) {
-        std::istringstream key_iss(key);
-        std::vector<std::string> sp;
-        std::string segment;
-        while (std::getline(key_iss, segment, '/')) {
-            sp.push_back(segment);
-        }
-        int vi = 3 * (std::stoi(sp[0]) - 1);
-        vertices[value] = {v[vi], v[vi + 1], v[vi + 2]};
-        if (sp.size() >= 2 && !sp[1].empty()) {
-            int uvi = 2 * (std::stoi(sp[1]) - 1);
-            uvs[value] = {vt[uvi], vt[uvi + 1]};
+    // chunks of at least 1 MB, ending after a line break
+    constexpr std::size_t MIN_CHUNK_SIZE = static_cast<std::size_t>(1) << 20;
+    thread_count = std::max(1u, thread_count);
+    const std::size_t chunk_size = std::max(MIN_CHUNK_SIZE, text.size() / (4 * thread_count) + 1);
+    std::vector<std::string_view> chunk_texts;
+    for (std::size_t begin = 0; begin < text.size();) {
+        std::size_t end = begin + chunk_size < text.size() ? text.find('\n', begin + chunk_size) : std::string_view::npos;
+        end = end == std::string_view::npos ? text.size() : end + 1;
+        chunk_texts.push_back(text.substr(begin, end - begin));
+        begin = end;
+    }
+    std::vector<ObjChunk> chunks(chunk_texts.size());
+    std::unique_ptr<ThreadPool> pool = thread_count > 1 && chunks.size() > 1 ? std::make_unique<ThreadPool>(std::min<std::size_t>(thread_count, chunks.size())) : nullptr;
+    auto parallelFor = [&pool](std::size_t count, auto&& func) {
+        if (pool != nullptr) {
+            pool->parallelFor(static_cast<uint32_t>(count), [&func](uint32_t i, uint32_t) { func(i); });
+        } else {
+            for (std::size_t i = 0; i < count; i++) { func(static_cast<uint32_t>(i)); }
         }
-        if (sp.size() >= 3 && !sp[2].empty()) {
-            int ni = 3 * (std::stoi(sp[2]) - 1);
-            normals[value] = {vn[ni], vn[ni + 1], vn[ni + 2]};
+    };
+    parallelFor(chunks.size(), [&](uint32_t i) { parseObjChunk(chunk_texts[i], chunks[i]); });
+
+    // the coordinates in file order
+    std::vector<float> v, vt, vn;
+    for (ObjChunk& chunk : chunks) {
+        v.insert(v.end(), chunk.v.begin(), chunk.v.end());
+        vt.insert(vt.end(), chunk.vt.begin(), chunk.vt.end());
+        vn.insert(vn.end(), chunk.vn.begin(), chunk.vn.end());
+    }
+    // the distinct corners of the chunks numbered in order of first appearance
+    ObjCornerTable corners(v.size() / 3);
+    std::vector<std::vector<uint32_t>> chunk_ids(chunks.size());
+    std::vector<std::size_t> index_offsets(chunks.size() + 1, 0);
+    for (std::size_t i = 0; i < chunks.size(); i++) {
+        const ObjChunk& chunk = chunks[i];
+        chunk_ids[i].reserve(chunk.corners.getCorners().size());
+        for (const ObjCorner& corner : chunk.corners.getCorners()) {
+            if (3 * static_cast<std::size_t>(corner.vertex) > v.size()) { throw std::runtime_error("OBJ vertex index out of range: " + std::to_string(corner.vertex)); }
+            chunk_ids[i].push_back(corners.add(corner));
         }
+        index_offsets[i + 1] = index_offsets[i] + chunk.indices.size();
     }
-    return {
-        std::make_shared<DataBuffer<Vector3>>(std::move(vertices)),
-        std::make_shared<DataBuffer<Vector2>>(std::move(uvs)),
-        std::make_shared<DataBuffer<Vector3>>(std::move(normals)),
-        std::make_shared<DataBuffer<uint32_t>>(std::move(indices))
-    };
+
+    const std::vector<ObjCorner>& unique = corners.getCorners();
+    const std::size_t vertex_count = unique.size();
+    auto indices = std::make_shared<DataBuffer<uint32_t>>(index_offsets.back());
+    auto vertices = std::make_shared<DataBuffer<Vector3>>(vertex_count);
+    auto uvs = std::make_shared<DataBuffer<Vector2>>(vertex_count);
+    auto normals = std::make_shared<DataBuffer<Vector3>>(vertex_count);
+    parallelFor(chunks.size(), [&](uint32_t i) {
+        const std::vector<uint32_t>& ids = chunk_ids[i];
+        uint32_t* out = indices->data() + index_offsets[i];
+        for (uint32_t index : chunks[i].indices) { *out++ = ids[index]; }
+    });
+    const std::size_t vertices_per_job = 1 << 16;
+    parallelFor((vertex_count + vertices_per_job - 1) / vertices_per_job, [&](uint32_t job) {
+        const std::size_t end = std::min(vertex_count, (job + 1) * vertices_per_job);
+        for (std::size_t i = job * vertices_per_job; i < end; i++) {
+            const ObjCorner& corner = unique[i];
+            const std::size_t vi = 3 * (corner.vertex - 1);
+            (*vertices)[i] = {v[vi], v[vi + 1], v[vi + 2]};
+            if (corner.uv != 0) {
+                if (2 * static_cast<std::size_t>(corner.uv) > vt.size()) { throw std::runtime_error("OBJ uv index out of range: " + std::to_string(corner.uv)); }
+                const std::size_t uvi = 2 * (corner.uv - 1);
+                (*uvs)[i] = {vt[uvi], vt[uvi + 1]};
+            }
+            if (corner.normal != 0) {
+                if (3 * static_cast<std::size_t>(corner.normal) > vn.size()) { throw std::runtime_error("OBJ normal index out of range: " + std::to_string(corner.normal)); }
+                const std::size_t ni = 3 * (corner.normal - 1);
+                (*normals)[i] = {vn[ni], vn[ni + 1], vn[ni + 2]};
+            }
+        }
+    });
+    return {vertices, uvs, normals, indices};
 }
 
 #pragma pack(push, 1)
@@ -127,11 +399,8 @@ struct BMPHeader {
 };
 #pragma pack(pop)
 
-std::shared_ptr<GraphicsBuffer<RGBColor>> loadBmpTexture(const std::string& filename, RGBColor transparency_key = RGBColor{0, 0, 0, 0}) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file.is_open()) {
-        throw std::runtime_error("Failed to open file: " + filename);
-    }
+// reads and checks the header of a 24-bit uncompressed BMP file, image_size is set when the file leaves it 0
+inline BMPHeader readBmpHeader(std::ifstream& file, const std::string& filename) {
     // read BMP header
     BMPHeader header;
     file.read(reinterpret_cast<char*>(&header), sizeof(header));
@@ -163,6 +432,15 @@ std::shared_ptr<GraphicsBuffer<RGBColor>> loadBmpTexture(const std::string& file
     if (file_size < header.offset + header.image_size) {
         throw std::runtime_error("Invalid BMP file size: " + filename);
     }
+    return header;
+}
+
+std::shared_ptr<GraphicsBuffer<RGBColor>> loadBmpTexture(const std::string& filename, RGBColor transparency_key = RGBColor{0, 0, 0, 0}) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open file: " + filename);
+    }
+    BMPHeader header = readBmpHeader(file, filename);
     // create image buffer
     auto imagebuffer = std::make_shared<GraphicsBuffer<RGBColor>>(header.width, header.height);
     // read image data
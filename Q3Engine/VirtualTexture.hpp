@@ -0,0 +1,557 @@
+#pragma once
+
+#include "RGBColor.hpp"
+#include "Buffer.hpp"
+#include "Math.hpp"
+#include "Texture.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace q3 {
+
+/**
+ * @brief Geometry of a page file: the mip levels of an image cut into square pages.
+ *
+ * The file starts with a header of magic, width, height, page size and level
+ * count as 32 bit integers in native byte order. The pages follow level by
+ * level and in row-major order within a level, page_size x page_size
+ * texels each. The levels are those of TextureT::generateMipmaps() down to
+ * 1x1 texel. The texels of the edge pages past the level size are zero.
+ */
+struct VirtualTextureLayout {
+    static constexpr uint32_t MAGIC = 0x31585456; // "VTX1"
+    static constexpr std::size_t HEADER_SIZE = 5 * sizeof(uint32_t);
+
+    struct Level {
+        uint32_t width, height;
+        uint32_t pages_x, pages_y;
+        // index of the first page of the level in the file
+        uint32_t first_page;
+    };
+
+    VirtualTextureLayout() : page_size(0), page_shift(0), page_count(0) {}
+    VirtualTextureLayout(uint32_t width, uint32_t height, uint32_t page_size) : page_size(page_size), page_shift(0), page_count(0) {
+        if (width == 0 || height == 0) { throw std::invalid_argument("virtual textures must not be empty"); }
+        if (page_size < 4 || page_size > 4096 || (page_size & (page_size - 1)) != 0) {
+            throw std::invalid_argument("the page size must be a power of two from 4 to 4096");
+        }
+        while ((1u << page_shift) < page_size) { page_shift++; }
+        for (;;) {
+            const uint32_t pages_x = (width + page_size - 1) / page_size;
+            const uint32_t pages_y = (height + page_size - 1) / page_size;
+            levels.push_back(Level{width, height, pages_x, pages_y, page_count});
+            page_count += pages_x * pages_y;
+            if (width == 1 && height == 1) { break; }
+            width = std::max(1u, width / 2);
+            height = std::max(1u, height / 2);
+        }
+    }
+
+    std::size_t pageBytes() const { return static_cast<std::size_t>(page_size) * page_size * sizeof(RGBColor); }
+    std::size_t pageOffset(uint32_t page) const { return HEADER_SIZE + page * pageBytes(); }
+    // the first level that fits into a single page, it and the smaller levels form the mip tail
+    uint32_t tailLevel() const {
+        uint32_t level = 0;
+        while (levels[level].pages_x * levels[level].pages_y > 1) { level++; }
+        return level;
+    }
+
+    uint32_t page_size;
+    uint32_t page_shift;
+    uint32_t page_count;
+    std::vector<Level> levels;
+};
+
+/**
+ * @brief Writes a page file from the rows of an image, without holding the image in memory.
+ *
+ * addRow() takes the rows of level 0 from top to bottom. The smaller levels
+ * are averaged from the rows as they arrive, like in
+ * TextureT::generateMipmaps(), so at most page_size rows per level are kept.
+ * For a 32k x 32k image and 128 texel pages this is about 32 MB.
+ */
+class VirtualTextureWriter {
+public:
+    VirtualTextureWriter(const std::string& filename, uint32_t width, uint32_t height, uint32_t page_size = 128)
+        : layout_(width, height, page_size), filename_(filename) {
+        file_.open(filename, std::ios::binary | std::ios::out | std::ios::trunc);
+        if (!file_.is_open()) { throw std::runtime_error("Failed to open file: " + filename); }
+        const uint32_t header[5] = {VirtualTextureLayout::MAGIC, width, height, page_size, static_cast<uint32_t>(layout_.levels.size())};
+        file_.write(reinterpret_cast<const char*>(header), sizeof(header));
+        for (const auto& level : layout_.levels) {
+            bands_.emplace_back(static_cast<std::size_t>(level.pages_x) * page_size * page_size);
+            rows_.push_back(0);
+        }
+    }
+
+    // width texels of the next row of level 0
+    void addRow(const RGBColor* row) {
+        if (rows_[0] == layout_.levels[0].height) { throw std::runtime_error("Too many rows for virtual texture: " + filename_); }
+        addRow(0, row);
+    }
+
+    // checks that every row was added and closes the file
+    void finish() {
+        if (rows_[0] != layout_.levels[0].height) { throw std::runtime_error("Missing rows for virtual texture: " + filename_); }
+        file_.close();
+        if (!file_) { throw std::runtime_error("Failed to write virtual texture: " + filename_); }
+    }
+
+    const VirtualTextureLayout& getLayout() const { return layout_; }
+
+private:
+    void addRow(uint32_t level, const RGBColor* row) {
+        const VirtualTextureLayout::Level& info = layout_.levels[level];
+        const uint32_t page_size = layout_.page_size;
+        const std::size_t stride = static_cast<std::size_t>(info.pages_x) * page_size;
+        const uint32_t y = rows_[level]++;
+        RGBColor* band_row = bands_[level].data() + (y % page_size) * stride;
+        std::copy(row, row + info.width, band_row);
+        // rows 2y and 2y + 1 make row y of the next level, the last row is repeated for a level of height 1
+        if (level + 1 < layout_.levels.size() && y / 2 < layout_.levels[level + 1].height && (y % 2 == 1 || y + 1 == info.height)) {
+            const RGBColor* row0 = y % 2 == 1 ? band_row - stride : band_row;
+            const uint32_t max_x = info.width - 1;
+            std::vector<RGBColor> next(layout_.levels[level + 1].width);
+            for (uint32_t x = 0; x < next.size(); x++) {
+                const RGBColor& c00 = row0[2 * x];
+                const RGBColor& c10 = row0[std::min(2 * x + 1, max_x)];
+                const RGBColor& c01 = band_row[2 * x];
+                const RGBColor& c11 = band_row[std::min(2 * x + 1, max_x)];
+                next[x] = RGBColor{static_cast<uint8_t>((c00.r + c10.r + c01.r + c11.r + 2) / 4),
+                                   static_cast<uint8_t>((c00.g + c10.g + c01.g + c11.g + 2) / 4),
+                                   static_cast<uint8_t>((c00.b + c10.b + c01.b + c11.b + 2) / 4),
+                                   static_cast<uint8_t>((c00.a + c10.a + c01.a + c11.a + 2) / 4)};
+            }
+            addRow(level + 1, next.data());
+        }
+        if (rows_[level] % page_size == 0 || rows_[level] == info.height) { writeBand(level, y / page_size); }
+    }
+
+    // writes the pages of a full band and clears it for the next one
+    void writeBand(uint32_t level, uint32_t page_y) {
+        const VirtualTextureLayout::Level& info = layout_.levels[level];
+        const uint32_t page_size = layout_.page_size;
+        const std::size_t stride = static_cast<std::size_t>(info.pages_x) * page_size;
+        std::vector<RGBColor>& band = bands_[level];
+        for (uint32_t page_x = 0; page_x < info.pages_x; page_x++) {
+            file_.seekp(static_cast<std::streamoff>(layout_.pageOffset(info.first_page + page_y * info.pages_x + page_x)));
+            for (uint32_t y = 0; y < page_size; y++) {
+                file_.write(reinterpret_cast<const char*>(band.data() + y * stride + page_x * page_size), page_size * sizeof(RGBColor));
+            }
+        }
+        if (!file_) { throw std::runtime_error("Failed to write virtual texture: " + filename_); }
+        std::fill(band.begin(), band.end(), RGBColor{0, 0, 0, 0});
+    }
+
+    VirtualTextureLayout layout_;
+    std::string filename_;
+    std::ofstream file_;
+    // the current page_size rows of every level
+    std::vector<std::vector<RGBColor>> bands_;
+    std::vector<uint32_t> rows_;
+};
+
+// writes the page file of an image in memory
+template<typename Layout>
+inline void writeVirtualTexture(const std::string& filename, const GraphicsBuffer<RGBColor, Layout>& image, uint32_t page_size = 128) {
+    VirtualTextureWriter writer(filename, image.getWidth(), image.getHeight(), page_size);
+    std::vector<RGBColor> row(image.getWidth());
+    for (uint32_t y = 0; y < image.getHeight(); y++) {
+        for (uint32_t x = 0; x < image.getWidth(); x++) { row[x] = image.getValue(x, y); }
+        writer.addRow(row.data());
+    }
+    writer.finish();
+}
+
+/**
+ * @brief Converts a BMP file to the page file of a VirtualTexture.
+ *
+ * Reads the image one row at a time, so images much larger than memory can
+ * be converted. The texels and the transparency key are those of
+ * loadBmpTexture().
+ */
+inline void createVirtualTextureFile(const std::string& bmp_filename, const std::string& filename, uint32_t page_size = 128,
+                                     RGBColor transparency_key = RGBColor{0, 0, 0, 0}) {
+    std::ifstream file(bmp_filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open file: " + bmp_filename);
+    }
+    BMPHeader header = readBmpHeader(file, bmp_filename);
+    VirtualTextureWriter writer(filename, header.width, header.height, page_size);
+    const uint32_t row_size = (header.width * 3 + 3) & ~3u;
+    std::vector<uint8_t> data(row_size);
+    std::vector<RGBColor> row(header.width);
+    // BMP rows are stored bottom up
+    for (uint32_t y = 0; y < header.height; ++y) {
+        file.seekg(static_cast<std::streamoff>(header.offset) + static_cast<std::streamoff>(header.height - 1 - y) * row_size, std::ios::beg);
+        file.read(reinterpret_cast<char*>(data.data()), row_size);
+        if (!file) {
+            throw std::runtime_error("Failed to read BMP file: " + bmp_filename);
+        }
+        for (uint32_t x = 0; x < header.width; ++x) {
+            uint8_t b = data[3 * x];
+            uint8_t g = data[3 * x + 1];
+            uint8_t r = data[3 * x + 2];
+            uint8_t a = 255;
+            if (r == transparency_key.r && g == transparency_key.g && b == transparency_key.b && a == transparency_key.a) {
+                a = 0;
+            }
+            row[x] = RGBColor{r, g, b, a};
+        }
+        writer.addRow(row.data());
+    }
+    writer.finish();
+}
+
+/**
+ * @brief A texture sampled from a page file, loading only the pages that are sampled.
+ *
+ * Opening the file reads the header and the mip tail, the levels that fit
+ * into a single page. Every other page starts out missing. A sample that
+ * hits a missing page requests it and falls back to the same texels in the
+ * next smaller level that is resident, down to the tail. So a frame always
+ * renders, blurrier where pages are still loading.
+ *
+ * A loader thread reads the requested pages from the file. update(), called
+ * once per frame while no thread samples the texture, publishes the loaded
+ * pages into a cache of a fixed number of pages and queues the pages the
+ * frame requested. When the cache is full the least recently sampled page
+ * is evicted, never one sampled in the last frame. Startup time and memory
+ * follow the pages a frame samples, not the size of the image.
+ *
+ * Sampling is thread-safe and takes no locks except for the first request of
+ * a missing page. The filters and the mip selection are those of TextureT.
+ *
+ * Usage example:
+ * @code
+ * q3::createVirtualTextureFile("terrain.bmp", "terrain.vtx");
+ * q3::VirtualTexture terrain("terrain.vtx", 1024);
+ * terrain.setFilter(q3::VirtualTexture::FILTER::TRILINEAR);
+ * // the fragment shader of TerrainShader calls terrain.sample(uv, derivatives.dx, derivatives.dy)
+ * TerrainShader shader{&terrain};
+ * while (running) {
+ *     rasterizer.drawBuffer(vertices, indices, shader, uvs);
+ *     terrain.update();
+ * }
+ * @endcode
+ */
+class VirtualTexture {
+public:
+    using FILTER = Texture::FILTER;
+
+    // cache_pages is the number of pages outside the tail kept in memory
+    explicit VirtualTexture(const std::string& filename, uint32_t cache_pages = 256)
+        : filename_(filename), filter_(FILTER::NEAREST), frame_(1), stop_(false), loading_(0) {
+        if (cache_pages == 0) { throw std::invalid_argument("the page cache must hold at least one page"); }
+        file_.open(filename, std::ios::binary);
+        if (!file_.is_open()) { throw std::runtime_error("Failed to open file: " + filename); }
+        uint32_t header[5];
+        file_.read(reinterpret_cast<char*>(header), sizeof(header));
+        if (!file_ || header[0] != VirtualTextureLayout::MAGIC) { throw std::runtime_error("Invalid virtual texture: " + filename); }
+        layout_ = VirtualTextureLayout(header[1], header[2], header[3]);
+        file_.seekg(0, std::ios::end);
+        if (header[4] != layout_.levels.size() || static_cast<std::size_t>(file_.tellg()) < layout_.pageOffset(layout_.page_count)) {
+            throw std::runtime_error("Invalid virtual texture size: " + filename);
+        }
+        pages_.reset(new PageEntry[layout_.page_count]);
+        for (uint32_t page = 0; page < layout_.page_count; page++) {
+            pages_[page].texels = nullptr;
+            pages_[page].slot = NO_SLOT;
+            pages_[page].last_used.store(0, std::memory_order_relaxed);
+            pages_[page].requested.store(false, std::memory_order_relaxed);
+        }
+        // the tail pages are contiguous at the end of the file and stay resident
+        const uint32_t tail_page = layout_.levels[layout_.tailLevel()].first_page;
+        const std::size_t page_texels = static_cast<std::size_t>(layout_.page_size) * layout_.page_size;
+        tail_.resize((layout_.page_count - tail_page) * page_texels);
+        file_.seekg(static_cast<std::streamoff>(layout_.pageOffset(tail_page)));
+        file_.read(reinterpret_cast<char*>(tail_.data()), static_cast<std::streamsize>(tail_.size() * sizeof(RGBColor)));
+        if (!file_) { throw std::runtime_error("Failed to read virtual texture: " + filename); }
+        for (uint32_t page = tail_page; page < layout_.page_count; page++) { pages_[page].texels = tail_.data() + (page - tail_page) * page_texels; }
+        // left uninitialized, the memory is only touched by the pages loaded into it
+        BufferAllocation allocation;
+        allocation.initialize = false;
+        cache_ = std::make_unique<GraphicsBuffer<RGBColor>>(layout_.page_size, cache_pages * layout_.page_size, allocation);
+        for (uint32_t slot = cache_pages; slot > 0; slot--) { free_slots_.push_back(slot - 1); }
+        slot_pages_.assign(cache_pages, NO_PAGE);
+        loader_ = std::thread([this]() { loaderLoop(); });
+    }
+    VirtualTexture(const VirtualTexture&) = delete;
+    VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+    ~VirtualTexture() {
+        {
+            std::lock_guard<std::mutex> lock(loader_mutex_);
+            stop_ = true;
+        }
+        loader_cv_.notify_all();
+        loader_.join();
+    }
+
+    void setFilter(FILTER filter) { filter_ = filter; }
+    FILTER getFilter() const { return filter_; }
+
+    uint32_t getWidth() const { return layout_.levels[0].width; }
+    uint32_t getHeight() const { return layout_.levels[0].height; }
+    uint32_t getLevelCount() const { return static_cast<uint32_t>(layout_.levels.size()); }
+    const VirtualTextureLayout& getLayout() const { return layout_; }
+
+    /**
+     * @brief Publishes the loaded pages and queues the pages requested since the last call.
+     *
+     * Call it once per frame after rendering, it must not run while another
+     * thread samples the texture. Requests of pages that were not sampled in
+     * the last frame are dropped, the queue is sorted so the smaller levels
+     * load first and holds at most as many pages as the cache.
+     */
+    void update() {
+        publish();
+        queueRequests();
+        frame_++;
+    }
+
+    // waits for the queued pages and publishes them, for a final frame or a screenshot without fallback texels
+    void finishLoading() {
+        queueRequests();
+        {
+            std::unique_lock<std::mutex> lock(loader_mutex_);
+            idle_cv_.wait(lock, [this]() { return queue_.empty() && loading_ == 0; });
+        }
+        publish();
+    }
+
+    // pages in the cache, without the tail
+    uint32_t getResidentPageCount() const { return static_cast<uint32_t>(slot_pages_.size() - free_slots_.size()); }
+    uint32_t getCachePageCount() const { return static_cast<uint32_t>(slot_pages_.size()); }
+    // bytes of the cache and the tail
+    std::size_t getSizeInBytes() const { return (static_cast<std::size_t>(cache_->getWidth()) * cache_->getHeight() + tail_.size()) * sizeof(RGBColor); }
+
+    inline RGBColor sample(const Vector2& uv) const { return sample(uv.x, uv.y); }
+    inline RGBColor sample(float u, float v) const {
+        const LevelView image{this, 0};
+        return filter_ == FILTER::NEAREST ? sampleNearest(image, u, v) : sampleBilinear(image, u, v);
+    }
+
+    // like TextureT::sample(uv, ddx, ddy)
+    inline RGBColor sample(const Vector2& uv, const Vector2& ddx, const Vector2& ddy) const {
+        return sampleLevel(uv, mipLevel(getWidth(), getHeight(), ddx, ddy));
+    }
+
+    inline RGBColor sampleLevel(const Vector2& uv, float level) const {
+        const float max_level = static_cast<float>(layout_.levels.size() - 1);
+        level = std::min(std::max(level, 0.0f), max_level);
+        if (filter_ != FILTER::TRILINEAR) {
+            const LevelView image{this, static_cast<uint32_t>(level + 0.5f)};
+            return filter_ == FILTER::NEAREST ? sampleNearest(image, uv.x, uv.y) : sampleBilinear(image, uv.x, uv.y);
+        }
+        const uint32_t level0 = static_cast<uint32_t>(level);
+        const RGBColor c0 = sampleBilinear(LevelView{this, level0}, uv.x, uv.y);
+        if (level0 + 1 == layout_.levels.size()) return c0;
+        const RGBColor c1 = sampleBilinear(LevelView{this, level0 + 1}, uv.x, uv.y);
+        const float t = level - static_cast<float>(level0);
+        return RGBColor{lerpChannel(c0.r, c1.r, t), lerpChannel(c0.g, c1.g, t), lerpChannel(c0.b, c1.b, t), lerpChannel(c0.a, c1.a, t)};
+    }
+
+    /**
+     * @brief Texel (x, y) of a level, or the texel covering it in the next resident level.
+     *
+     * Marks every page it looks at as used in this frame and requests the
+     * missing ones.
+     */
+    inline RGBColor getValue(uint32_t level, uint32_t x, uint32_t y) const {
+        const uint32_t shift = layout_.page_shift;
+        const uint32_t mask = layout_.page_size - 1;
+        for (;;) {
+            const VirtualTextureLayout::Level& info = layout_.levels[level];
+            const uint32_t page = info.first_page + (y >> shift) * info.pages_x + (x >> shift);
+            PageEntry& entry = pages_[page];
+            if (entry.last_used.load(std::memory_order_relaxed) != frame_) { entry.last_used.store(frame_, std::memory_order_relaxed); }
+            if (entry.texels != nullptr) { return entry.texels[((y & mask) << shift) + (x & mask)]; }
+            if (!entry.requested.load(std::memory_order_relaxed) && !entry.requested.exchange(true, std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> lock(request_mutex_);
+                requested_.push_back(page);
+            }
+            // the tail is resident, so this ends at the tail level at the latest
+            level++;
+            x = std::min(x >> 1, layout_.levels[level].width - 1);
+            y = std::min(y >> 1, layout_.levels[level].height - 1);
+        }
+    }
+
+private:
+    static constexpr uint32_t NO_SLOT = ~0u;
+    static constexpr uint32_t NO_PAGE = ~0u;
+
+    struct PageEntry {
+        // null while the page is missing, written by update() only
+        const RGBColor* texels;
+        uint32_t slot;
+        // frame of the last sample
+        std::atomic<uint32_t> last_used;
+        // requested and not yet published or dropped
+        std::atomic<bool> requested;
+    };
+
+    struct LoadedPage {
+        uint32_t page;
+        std::vector<RGBColor> texels;
+    };
+
+    // one level as an image for the filters of Texture.hpp
+    struct LevelView {
+        const VirtualTexture* texture;
+        uint32_t level;
+
+        uint32_t getWidth() const { return texture->layout_.levels[level].width; }
+        uint32_t getHeight() const { return texture->layout_.levels[level].height; }
+        RGBColor getValue(uint32_t x, uint32_t y) const { return texture->getValue(level, x, y); }
+    };
+
+    // installs the pages the loader thread finished
+    void publish() {
+        std::vector<LoadedPage> loaded;
+        {
+            std::lock_guard<std::mutex> lock(loader_mutex_);
+            if (loader_error_) { std::rethrow_exception(std::exchange(loader_error_, nullptr)); }
+            loaded.swap(loaded_);
+        }
+        for (auto& page : loaded) { install(page); }
+    }
+
+    // queues the pages requested in this frame, drops the queued pages it did not sample
+    void queueRequests() {
+        std::vector<uint32_t> requested;
+        {
+            std::lock_guard<std::mutex> lock(request_mutex_);
+            requested.swap(requested_);
+        }
+        {
+            std::lock_guard<std::mutex> lock(loader_mutex_);
+            queue_.insert(queue_.end(), requested.begin(), requested.end());
+            auto stale = std::partition(queue_.begin(), queue_.end(), [this](uint32_t page) {
+                return pages_[page].last_used.load(std::memory_order_relaxed) == frame_;
+            });
+            for (auto it = stale; it != queue_.end(); ++it) { pages_[*it].requested.store(false, std::memory_order_relaxed); }
+            queue_.erase(stale, queue_.end());
+            // the loader takes the last page, pages of the smaller levels have the larger indices
+            std::sort(queue_.begin(), queue_.end());
+            if (queue_.size() > slot_pages_.size()) {
+                const auto excess = queue_.size() - slot_pages_.size();
+                for (auto it = queue_.begin(); it != queue_.begin() + excess; ++it) { pages_[*it].requested.store(false, std::memory_order_relaxed); }
+                queue_.erase(queue_.begin(), queue_.begin() + excess);
+            }
+        }
+        loader_cv_.notify_one();
+    }
+
+    // copies a loaded page into a free slot or the slot of the least recently used page
+    void install(LoadedPage& loaded) {
+        PageEntry& entry = pages_[loaded.page];
+        // loaded twice when its request was dropped while it was loading
+        if (entry.texels != nullptr) { return; }
+        uint32_t slot = NO_SLOT;
+        if (!free_slots_.empty()) {
+            slot = free_slots_.back();
+            free_slots_.pop_back();
+        } else {
+            uint32_t oldest = frame_;
+            for (uint32_t i = 0; i < slot_pages_.size(); i++) {
+                const uint32_t last_used = pages_[slot_pages_[i]].last_used.load(std::memory_order_relaxed);
+                if (last_used < oldest) {
+                    oldest = last_used;
+                    slot = i;
+                }
+            }
+            if (slot == NO_SLOT) {
+                // every cached page was sampled in the last frame, the page is requested again when still needed
+                entry.requested.store(false, std::memory_order_relaxed);
+                return;
+            }
+            PageEntry& evicted = pages_[slot_pages_[slot]];
+            evicted.texels = nullptr;
+            evicted.slot = NO_SLOT;
+        }
+        RGBColor* texels = cache_->getData() + static_cast<std::size_t>(slot) * layout_.page_size * layout_.page_size;
+        std::copy(loaded.texels.begin(), loaded.texels.end(), texels);
+        slot_pages_[slot] = loaded.page;
+        entry.texels = texels;
+        entry.slot = slot;
+        entry.requested.store(false, std::memory_order_relaxed);
+    }
+
+    void loaderLoop() {
+        const std::size_t page_texels = static_cast<std::size_t>(layout_.page_size) * layout_.page_size;
+        for (;;) {
+            uint32_t page;
+            {
+                std::unique_lock<std::mutex> lock(loader_mutex_);
+                loader_cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+                if (stop_) { return; }
+                page = queue_.back();
+                queue_.pop_back();
+                loading_++;
+            }
+            LoadedPage loaded{page, std::vector<RGBColor>(page_texels)};
+            std::exception_ptr error;
+            file_.seekg(static_cast<std::streamoff>(layout_.pageOffset(page)));
+            file_.read(reinterpret_cast<char*>(loaded.texels.data()), static_cast<std::streamsize>(page_texels * sizeof(RGBColor)));
+            if (!file_) {
+                file_.clear();
+                error = std::make_exception_ptr(std::runtime_error("Failed to read virtual texture: " + filename_));
+            }
+            {
+                std::lock_guard<std::mutex> lock(loader_mutex_);
+                if (error) {
+                    loader_error_ = error;
+                } else {
+                    loaded_.push_back(std::move(loaded));
+                }
+                loading_--;
+            }
+            idle_cv_.notify_all();
+        }
+    }
+
+    std::string filename_;
+    // read by the loader thread after the constructor
+    std::ifstream file_;
+    VirtualTextureLayout layout_;
+    FILTER filter_;
+    std::unique_ptr<PageEntry[]> pages_;
+    std::vector<RGBColor> tail_;
+    // cache slots of page_size x page_size texels, the page in every slot and the free slots
+    std::unique_ptr<GraphicsBuffer<RGBColor>> cache_;
+    std::vector<uint32_t> slot_pages_;
+    std::vector<uint32_t> free_slots_;
+    // advanced by update(), pages sampled since then have it as last_used
+    uint32_t frame_;
+
+    mutable std::mutex request_mutex_;
+    mutable std::vector<uint32_t> requested_;
+
+    std::mutex loader_mutex_;
+    std::condition_variable loader_cv_;
+    std::condition_variable idle_cv_;
+    // pages to load, sorted by index, the loader takes the last one
+    std::vector<uint32_t> queue_;
+    std::vector<LoadedPage> loaded_;
+    std::exception_ptr loader_error_;
+    bool stop_;
+    uint32_t loading_;
+    std::thread loader_;
+};
+
+}
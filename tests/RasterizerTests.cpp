@@ -0,0 +1,276 @@
+// standalone checks of the rasterizer, returns nonzero if one fails
+// g++ -std=c++17 -O2 -I. tests/RasterizerTests.cpp -o rasterizer_tests -pthread && ./rasterizer_tests
+
+#include "Q3Engine/Rasterizer.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace q3;
+using Rasterizer = RasterizerT<float>;
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const std::string& message) {
+    if (condition) return;
+    std::printf("FAILED: %s\n", message.c_str());
+    failures++;
+}
+
+// flat color with a configurable alpha, counts its fragments
+struct FlatShader {
+    using Attributes = Vector2;
+    using Varying = Vector2;
+    uint8_t alpha = 128;
+    std::atomic<uint64_t> fragments{0};
+
+    bool isOpaque() const { return alpha == 255; }
+    void vertexShader(Vertex&, const Vector2& attributes, Vector2& varying) { varying = attributes; }
+    RGBColor fragmentShader(const Triangle&, const Barycentric&, const Vector2&) {
+        fragments++;
+        return RGBColor{200, 60, 20, alpha};
+    }
+};
+
+// opaque color from interpolated varyings
+struct VaryingShader {
+    using Attributes = Vector2;
+    using Varying = Vector2;
+
+    bool isOpaque() const { return true; }
+    void vertexShader(Vertex&, const Vector2& attributes, Vector2& varying) { varying = attributes; }
+    RGBColor fragmentShader(const Triangle&, const Barycentric&, const Vector2& uv) {
+        return RGBColor{static_cast<uint8_t>(uv.x * 255.0f), static_cast<uint8_t>(uv.y * 255.0f), 0, 255};
+    }
+};
+
+// a grid of quads in screen space, rows of vertices lie on pixel rows and columns are jittered by seed
+struct Grid {
+    DataBuffer<Vector3> vertices;
+    DataBuffer<Vector2> uvs;
+    DataBuffer<uint32_t> indices;
+};
+
+Grid createGrid(uint32_t width, uint32_t height, uint32_t size, uint32_t seed) {
+    Grid grid;
+    uint32_t state = seed * 2654435761u + 1u;
+    auto jitter = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return static_cast<float>(state >> 8) / static_cast<float>(1u << 24) * 3.0f - 1.5f;
+    };
+    for (uint32_t j = 0; j < size; j++) {
+        for (uint32_t i = 0; i < size; i++) {
+            float x = static_cast<float>(width) * static_cast<float>(i) / static_cast<float>(size - 1);
+            float y = static_cast<float>(height) * static_cast<float>(j) / static_cast<float>(size - 1);
+            if (seed != 0) {
+                x += jitter();
+                y = std::round(y + jitter());
+            }
+            grid.vertices.push_back({x / static_cast<float>(width) * 2.0f - 1.0f, 1.0f - y / static_cast<float>(height) * 2.0f, 0.5f});
+            grid.uvs.push_back({static_cast<float>(i) / static_cast<float>(size - 1), static_cast<float>(j) / static_cast<float>(size - 1)});
+        }
+    }
+    for (uint32_t j = 0; j + 1 < size; j++) {
+        for (uint32_t i = 0; i + 1 < size; i++) {
+            uint32_t a = j * size + i;
+            uint32_t b = a + 1;
+            uint32_t c = a + size;
+            uint32_t d = c + 1;
+            for (uint32_t index : {a, b, d, a, d, c}) { grid.indices.push_back(index); }
+        }
+    }
+    return grid;
+}
+
+struct Image {
+    std::vector<RGBColor> pixels;
+    uint64_t fragments = 0;
+};
+
+Image render(uint32_t width, uint32_t height, const std::function<void(Rasterizer&)>& configure, const DataBuffer<Vector3>& vertices, const DataBuffer<uint32_t>& indices, const DataBuffer<Vector2>& uvs, uint8_t alpha) {
+    auto framebuffer = std::make_shared<GraphicsBuffer<RGBColor>>(width, height);
+    auto depthbuffer = std::make_shared<GraphicsBuffer<float>>(width, height);
+    Rasterizer rasterizer(framebuffer, depthbuffer);
+    configure(rasterizer);
+    rasterizer.clearFrameBuffer({0, 0, 0, 255});
+    rasterizer.clearDepthBuffer();
+    FlatShader shader;
+    shader.alpha = alpha;
+    rasterizer.drawBuffer(vertices, indices, shader, uvs);
+    Image image;
+    image.fragments = shader.fragments;
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) { image.pixels.push_back(framebuffer->getValue(x, y)); }
+    }
+    return image;
+}
+
+uint32_t countDifferences(const Image& a, const Image& b) {
+    uint32_t count = 0;
+    for (std::size_t i = 0; i < a.pixels.size(); i++) {
+        const RGBColor& p = a.pixels[i];
+        const RGBColor& q = b.pixels[i];
+        if (p.r != q.r || p.g != q.g || p.b != q.b || p.a != q.a) count++;
+    }
+    return count;
+}
+
+// triangles whose horizontal edge lies on a pixel row shade that row like the exact per-pixel test does
+void testEdgeOnPixelRow() {
+    const uint32_t width = 64, height = 48;
+    DataBuffer<Vector2> uvs{{0.0f, 0.0f}, {0.0f, 0.0f}, {0.0f, 0.0f}};
+    DataBuffer<uint32_t> indices{0, 1, 2};
+    uint32_t state = 1;
+    auto random = [&state](float min, float max) {
+        state = state * 1664525u + 1013904223u;
+        return min + (max - min) * static_cast<float>(state >> 8) / static_cast<float>(1u << 24);
+    };
+    for (uint32_t i = 0; i < 256; i++) {
+        const float edge_y = std::round(random(1.0f, static_cast<float>(height - 1)));
+        const float ndc_y = 1.0f - edge_y / static_cast<float>(height) * 2.0f;
+        // the edge opposite v0, where l0 = 1 - l1 - l2 is zero, the row value rounds differently than the per-pixel value
+        DataBuffer<Vector3> vertices{{random(-1.0f, 1.0f), random(-1.0f, 1.0f), 0.5f}, {random(0.1f, 1.0f), ndc_y, 0.5f}, {random(-1.0f, -0.1f), ndc_y, 0.5f}};
+        Image scalar = render(width, height, [](Rasterizer& r) { r.setThreadCount(1); }, vertices, indices, uvs, 255);
+        Image block = render(width, height, [](Rasterizer& r) {
+            r.setThreadCount(1);
+            r.setFragmentMode(Rasterizer::FRAGMENT_MODE::BLOCK);
+        }, vertices, indices, uvs, 255);
+        std::string name = "triangle " + std::to_string(i) + " with an edge on row " + std::to_string(static_cast<int>(edge_y));
+        check(scalar.fragments == block.fragments, name + " fragment count");
+        check(countDifferences(scalar, block) == 0, name + " image");
+    }
+}
+
+// both fragment modes take the same coverage decision, checked with blending so a pixel shaded twice shows up
+void testScalarMatchesBlock() {
+    const uint32_t width = 197, height = 143;
+    for (uint32_t seed = 0; seed < 32; seed++) {
+        Grid grid = createGrid(width, height, 13, seed);
+        for (auto raster_mode : {Rasterizer::RASTER_MODE::FLOAT, Rasterizer::RASTER_MODE::FIXED_POINT}) {
+            for (auto blend_mode : {BLEND_MODE::ALPHA, BLEND_MODE::ADDITIVE}) {
+                auto configure = [raster_mode, blend_mode](Rasterizer& r) {
+                    r.setThreadCount(2);
+                    r.setTileSize(32);
+                    r.setRasterMode(raster_mode);
+                    r.setBlendMode(blend_mode);
+                };
+                Image scalar = render(width, height, configure, grid.vertices, grid.indices, grid.uvs, 128);
+                for (auto simd_level : {SIMD_LEVEL::SCALAR, SIMD_LEVEL::SSE2, SIMD_LEVEL::AVX2}) {
+                    Image block = render(width, height, [&configure, simd_level](Rasterizer& r) {
+                        configure(r);
+                        r.setFragmentMode(Rasterizer::FRAGMENT_MODE::BLOCK);
+                        r.setSimdLevel(simd_level);
+                    }, grid.vertices, grid.indices, grid.uvs, 128);
+                    std::string name = "grid seed " + std::to_string(seed) + " raster mode " + std::to_string(static_cast<int>(raster_mode)) +
+                                       " blend mode " + std::to_string(static_cast<int>(blend_mode)) + " simd level " + std::to_string(static_cast<int>(simd_level));
+                    check(scalar.fragments == block.fragments, name + " fragment count");
+                    check(countDifferences(scalar, block) == 0, name + " image");
+                }
+            }
+        }
+    }
+}
+
+// resolving the visibility buffer shades every pixel like the forward path, also when neighbouring pixels show different triangles
+void testDeferredMatchesForward() {
+    const uint32_t width = 197, height = 143;
+    Grid grid = createGrid(width, height, 13, 1);
+    // the second draw covers half of the grid, so the resolve alternates between the draws
+    DataBuffer<uint32_t> overlay_indices;
+    for (std::size_t i = 0; i < grid.indices.size(); i += 12) {
+        for (std::size_t k = i; k < i + 6 && k < grid.indices.size(); k++) { overlay_indices.push_back(grid.indices[k]); }
+    }
+    DataBuffer<Vector3> overlay_vertices = grid.vertices;
+    for (Vector3& vertex : overlay_vertices) { vertex.z = 0.25f; }
+    for (bool block : {false, true}) {
+        std::vector<RGBColor> images[2];
+        for (bool deferred : {false, true}) {
+            auto framebuffer = std::make_shared<GraphicsBuffer<RGBColor>>(width, height);
+            auto depthbuffer = std::make_shared<GraphicsBuffer<float>>(width, height);
+            Rasterizer rasterizer(framebuffer, depthbuffer);
+            rasterizer.setThreadCount(2);
+            rasterizer.setFragmentMode(block ? Rasterizer::FRAGMENT_MODE::BLOCK : Rasterizer::FRAGMENT_MODE::SCALAR);
+            rasterizer.setDeferredShading(deferred);
+            rasterizer.clearFrameBuffer({0, 0, 0, 255});
+            rasterizer.clearDepthBuffer();
+            VaryingShader shader;
+            rasterizer.drawBuffer(grid.vertices, grid.indices, shader, grid.uvs);
+            rasterizer.drawBuffer(overlay_vertices, overlay_indices, shader, grid.uvs);
+            rasterizer.resolveVisibilityBuffer();
+            for (uint32_t y = 0; y < height; y++) {
+                for (uint32_t x = 0; x < width; x++) { images[deferred].push_back(framebuffer->getValue(x, y)); }
+            }
+        }
+        uint32_t differences = 0;
+        for (std::size_t i = 0; i < images[0].size(); i++) {
+            if (images[0][i].r != images[1][i].r || images[0][i].g != images[1][i].g) differences++;
+        }
+        check(differences == 0, std::string("deferred matches forward in ") + (block ? "block" : "scalar") + " mode");
+    }
+}
+
+// tile-local supersampling rasterizes a frame of several draws like the full resolution sample buffers do
+void testTileLocalSuperSamplingMatchesSuperSampling() {
+    const uint32_t width = 197, height = 143;
+    Grid grid = createGrid(width, height, 13, 2);
+    // every draw covers a band of the grid, the half transparent draws overlap the opaque ones
+    std::vector<DataBuffer<uint32_t>> bands(6);
+    for (std::size_t i = 0; i < grid.indices.size(); i++) { bands[(i / 3) * bands.size() / (grid.indices.size() / 3)].push_back(grid.indices[i]); }
+    DataBuffer<Vector3> overlay_vertices = grid.vertices;
+    for (Vector3& vertex : overlay_vertices) {
+        vertex.x = vertex.x * 0.8f + 0.05f;
+        vertex.y = vertex.y * 0.7f - 0.1f;
+        vertex.z = 0.25f;
+    }
+    for (uint32_t thread_count : {1u, 3u}) {
+        std::vector<RGBColor> images[2];
+        for (bool tile_local : {false, true}) {
+            auto framebuffer = std::make_shared<GraphicsBuffer<RGBColor>>(width, height);
+            auto depthbuffer = std::make_shared<GraphicsBuffer<float>>(width, height);
+            Rasterizer rasterizer(framebuffer, depthbuffer);
+            rasterizer.setThreadCount(thread_count);
+            rasterizer.setTileSize(32);
+            rasterizer.setAntialiasingMode(Rasterizer::AA_MODE::SSAA_4X);
+            rasterizer.setTileLocalSuperSampling(tile_local);
+            rasterizer.clearFrameBuffer({0, 0, 0, 255});
+            rasterizer.clearDepthBuffer();
+            VaryingShader opaque;
+            FlatShader transparent;
+            for (const DataBuffer<uint32_t>& band : bands) { rasterizer.drawBuffer(grid.vertices, band, opaque, grid.uvs); }
+            for (const DataBuffer<uint32_t>& band : bands) { rasterizer.drawBuffer(overlay_vertices, band, transparent, grid.uvs); }
+            rasterizer.resolveVisibilityBuffer();
+            for (uint32_t y = 0; y < height; y++) {
+                for (uint32_t x = 0; x < width; x++) { images[tile_local].push_back(framebuffer->getValue(x, y)); }
+            }
+        }
+        uint32_t differences = 0;
+        for (std::size_t i = 0; i < images[0].size(); i++) {
+            const RGBColor& a = images[0][i];
+            const RGBColor& b = images[1][i];
+            if (a.r != b.r || a.g != b.g || a.b != b.b || a.a != b.a) differences++;
+        }
+        check(differences == 0, "tile-local supersampling matches supersampling with " + std::to_string(thread_count) + " threads");
+    }
+}
+
+} // namespace
+
+int main() {
+    testEdgeOnPixelRow();
+    testScalarMatchesBlock();
+    testDeferredMatchesForward();
+    testTileLocalSuperSamplingMatchesSuperSampling();
+    if (failures != 0) {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+    return 0;
+}